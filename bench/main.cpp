@@ -0,0 +1,474 @@
+// Headless benchmark of storage and view operations on a synthetic notebook.
+// Results are printed as JSON to be compared between releases, e.g.:
+//   procyon_bench --memos 150000 --folders 300 --output bench.json
+
+#include "core/Enot.h"
+#include "core/MemoStore.h"
+#include "core/MemoType.h"
+#include "core/SqlHelper.h"
+#include "markdown/MarkdownHelper.h"
+#include "tabs/GridViewModels.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <algorithm>
+
+namespace {
+
+struct BenchParams
+{
+    int folders = 100;
+    int memos = 10000;
+    int props = 3;
+    int sheets = 0;
+    int bodySize = 2000;
+    int iterations = 5;
+    int samples = 200;
+    quint32 seed = 42;
+};
+
+const QStringList WORDS = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+    "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore",
+    "magna", "aliqua", "enim", "ad", "minim", "veniam", "quis", "nostrud",
+};
+
+const QStringList PROP_VALUES = { "Open", "Solved", "Closed", "Pending", "Rejected" };
+
+class Generator
+{
+public:
+    Generator(const BenchParams& params) : _params(params), _rnd(params.seed) {}
+
+    QString word() { return WORDS.at(_rnd.bounded(WORDS.size())); }
+
+    QString title()
+    {
+        QStringList words;
+        int count = 2 + _rnd.bounded(5);
+        for (int i = 0; i < count; i++)
+            words << word();
+        words[0][0] = words[0][0].toUpper();
+        return words.join(' ');
+    }
+
+    // Something looking like a real markdown memo: headers, paragraphs, lists and code
+    QString body(int size)
+    {
+        QString text;
+        text.reserve(size + 100);
+        while (text.size() < size)
+        {
+            switch (_rnd.bounded(6))
+            {
+            case 0:
+                text += "## " + title() + "\n\n";
+                break;
+            case 1:
+                for (int i = 0; i < 3; i++)
+                    text += "- " + title() + '\n';
+                text += '\n';
+                break;
+            case 2:
+                text += "```\n" + word() + " = " + QString::number(_rnd.bounded(1000)) + "\n```\n\n";
+                break;
+            default:
+                for (int i = 0; i < 40; i++)
+                    text += (i % 7 == 3 ? QString("**" + word() + "**") : word()) + ' ';
+                text += "\n\n";
+            }
+        }
+        return text;
+    }
+
+    QString propValue() { return PROP_VALUES.at(_rnd.bounded(PROP_VALUES.size())); }
+
+    int bounded(int max) { return _rnd.bounded(max); }
+
+private:
+    BenchParams _params;
+    QRandomGenerator _rnd;
+};
+
+QString propName(int index)
+{
+    return index == 0 ? QString("Status") : QString("Prop%1").arg(index);
+}
+
+QString generateNotebook(const QString& fileName, const BenchParams& params)
+{
+    auto res = Enot::create(fileName);
+    if (!res.ok()) return res.error();
+
+    QScopedPointer<Enot> enot(res.result());
+    Generator gen(params);
+
+    Enot::Batch batch(enot.data());
+
+    QList<Folder*> folders;
+    for (int i = 0; i < std::max(params.folders, 1); i++)
+    {
+        // Make a bit of hierarchy, every tenth folder is top level
+        auto parent = (i % 10 == 0 || folders.isEmpty()) ? enot->root() : folders.at(i - i % 10);
+        auto folderRes = enot->createFolder(parent, QString("Folder %1").arg(i + 1));
+        if (!folderRes.ok()) return folderRes.error();
+        folders << folderRes.result();
+    }
+
+    // The first folder gets a grid memo to benchmark grid models
+    auto gridRes = enot->createMemo(folders.first(), MemoType::gridView());
+    if (!gridRes.ok()) return gridRes.error();
+    enot->updateMemo(gridRes.result(), { .title = QString("Grid") });
+
+    for (int i = 0; i < params.memos; i++)
+    {
+        // Half of memos go to the first folder to get a heavy grid
+        auto folder = (i % 2 == 0) ? folders.first() : folders.at(gen.bounded(folders.size()));
+        auto memoRes = enot->createMemo(folder, MemoType::markdown());
+        if (!memoRes.ok()) return memoRes.error();
+
+        MemoUpdateParam update;
+        update.title = gen.title();
+        update.data = gen.body(params.bodySize);
+        if (params.props > 0)
+        {
+            QHash<QString, QString> props;
+            for (int p = 0; p < params.props; p++)
+                props.insert(propName(p), gen.propValue());
+            update.props = props;
+        }
+        if (!enot->updateMemo(memoRes.result(), update))
+            return QString("Unable to update memo #%1").arg(memoRes.result()->id());
+
+        // There is no API for sheets yet, they are written directly
+        for (int s = 0; s < params.sheets; s++)
+        {
+            auto sheetRes = Ori::Sql::ActionQuery("INSERT INTO MemoSheets (MemoId, Data) VALUES (:MemoId, :Data)")
+                .param("MemoId", memoRes.result()->id())
+                .param("Data", gen.body(std::max(params.bodySize / 4, 100)))
+                .exec();
+            if (!sheetRes.isEmpty()) return sheetRes;
+        }
+    }
+
+    return QString();
+}
+
+//------------------------------------------------------------------------------
+
+class Bench
+{
+public:
+    Bench(const BenchParams& params) : _params(params) {}
+
+    template <typename Func> void measure(const QString& name, int iterations, Func func)
+    {
+        QVector<double> times;
+        times.reserve(iterations);
+        for (int i = 0; i < iterations; i++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            func();
+            times << timer.nsecsElapsed() / 1e6;
+        }
+        std::sort(times.begin(), times.end());
+
+        double total = 0;
+        for (auto t : std::as_const(times))
+            total += t;
+
+        QJsonObject result;
+        result["name"] = name;
+        result["iterations"] = iterations;
+        result["min_ms"] = times.first();
+        result["median_ms"] = times.at(times.size() / 2);
+        result["mean_ms"] = total / times.size();
+        result["max_ms"] = times.last();
+        _results.append(result);
+
+        qInfo().noquote() << QString("%1: median %2 ms").arg(name).arg(times.at(times.size() / 2), 0, 'f', 3);
+    }
+
+    QJsonObject report(double generationMs) const
+    {
+        QJsonObject params;
+        params["folders"] = _params.folders;
+        params["memos"] = _params.memos;
+        params["props"] = _params.props;
+        params["sheets"] = _params.sheets;
+        params["body_size"] = _params.bodySize;
+        params["iterations"] = _params.iterations;
+        params["samples"] = _params.samples;
+        params["seed"] = int(_params.seed);
+
+        QJsonObject root;
+        root["version"] = QString(APP_VER);
+        root["platform"] = QSysInfo::prettyProductName();
+        root["params"] = params;
+        root["generation_ms"] = generationMs;
+        root["results"] = _results;
+        return root;
+    }
+
+private:
+    BenchParams _params;
+    QJsonArray _results;
+};
+
+QList<Memo*> sampleMemos(Enot* enot, int count)
+{
+    QList<Memo*> memos;
+    std::function<void(Folder*)> collect = [&](Folder* folder){
+        for (auto memo : folder->memos())
+            if (memo->type() != MemoType::gridView())
+                memos << memo;
+        for (auto child : folder->folders())
+            collect(child);
+    };
+    collect(enot->root());
+
+    // Evenly spread samples over the whole notebook
+    QList<Memo*> samples;
+    if (memos.isEmpty() || count <= 0) return samples;
+    int step = std::max(int(memos.size()) / count, 1);
+    for (int i = 0; i < memos.size() && samples.size() < count; i += step)
+        samples << memos.at(i);
+    return samples;
+}
+
+Memo* findGridMemo(Folder* folder)
+{
+    for (auto memo : folder->memos())
+        if (memo->type() == MemoType::gridView())
+            return memo;
+    for (auto child : folder->folders())
+        if (auto memo = findGridMemo(child); memo)
+            return memo;
+    return nullptr;
+}
+
+int runBenchmarks(const QString& fileName, Bench& bench, const BenchParams& params)
+{
+    const int n = params.iterations;
+
+    bench.measure("enot_open", n, [&]{
+        auto res = Enot::open(fileName);
+        if (res.ok()) delete res.result();
+    });
+
+    bench.measure("enot_open_preload_props", n, [&]{
+        auto res = Enot::open(fileName, true);
+        if (res.ok()) delete res.result();
+    });
+
+    auto res = Enot::open(fileName);
+    if (!res.ok())
+    {
+        qCritical().noquote() << res.error();
+        return 1;
+    }
+    QScopedPointer<Enot> enot(res.result());
+
+    auto samples = sampleMemos(enot.data(), params.samples);
+    qInfo() << "Sample memos:" << samples.size();
+
+    bench.measure("enot_load_memo", n, [&]{
+        for (auto memo : std::as_const(samples))
+            enot->loadMemo(memo);
+    });
+
+    bench.measure("memo_store_load_props", n, [&]{
+        for (auto memo : std::as_const(samples))
+            Store::memos()->loadProps(memo->id());
+    });
+
+    bench.measure("memo_store_load_all_props", n, [&]{
+        Store::memos()->loadAllProps();
+    });
+
+    bench.measure("enot_update_memo", n, [&]{
+        for (auto memo : std::as_const(samples))
+            enot->updateMemo(memo, { .data = QString(memo->data() + '.') });
+    });
+
+    bench.measure("enot_update_memo_batch", n, [&]{
+        Enot::Batch batch(enot.data());
+        for (auto memo : std::as_const(samples))
+            enot->updateMemo(memo, { .data = QString(memo->data() + '.') });
+    });
+
+    auto markdownText = Generator(params).body(std::max(params.bodySize, 1000) * 10);
+    bench.measure("markdown_to_html", n, [&]{
+        MarkdownHelper::markdownToHtml(markdownText);
+    });
+
+    // Converting again after a small edit, as when preview is shown while editing
+    MarkdownHelper::IncrementalConverter markdownConverter;
+    markdownConverter.markdownToHtml(markdownText);
+    int markdownEdits = 0;
+    bench.measure("markdown_to_html_incremental", n, [&]{
+        markdownConverter.markdownToHtml(markdownText + "\n\nEdit " + QString::number(markdownEdits++));
+    });
+
+    // Many small texts, as comments of an issue memo
+    QStringList markdownFragments;
+    Generator fragmentGenerator(params);
+    for (int i = 0; i < 100; i++)
+        markdownFragments << fragmentGenerator.body(500);
+    bench.measure("markdown_to_html_fragments", n, [&]{
+        for (const auto& fragment : std::as_const(markdownFragments))
+            MarkdownHelper::markdownToHtml(fragment);
+    });
+    bench.measure("markdown_to_html_batch", n, [&]{
+        MarkdownHelper::markdownToHtmlBatch(markdownFragments);
+    });
+
+    auto gridMemo = findGridMemo(enot->root());
+    if (gridMemo)
+    {
+        enot->preloadProps(gridMemo->parent());
+
+        QStringList propNames;
+        for (int p = 0; p < params.props; p++)
+            propNames << propName(p);
+
+        GridViewTableModel tableModel(gridMemo, nullptr);
+        tableModel.setPropColumns(propNames);
+
+        bench.measure("grid_load_columns", n, [&]{
+            tableModel.reset();
+        });
+
+        bench.measure("grid_filter_title", n, [&]{
+            tableModel.setFilters("lorem", {});
+            tableModel.setFilters({}, {});
+        });
+
+        if (params.props > 0)
+            bench.measure("grid_filter_prop", n, [&]{
+                tableModel.setFilters({}, {{propName(0), PROP_VALUES.at(1)}});
+                tableModel.setFilters({}, {});
+            });
+
+        bench.measure("grid_sort_title", n, [&]{
+            tableModel.sort(1, Qt::AscendingOrder);
+            tableModel.sort(1, Qt::DescendingOrder);
+        });
+
+        if (params.props > 0)
+            bench.measure("grid_sort_prop", n, [&]{
+                tableModel.sort(2, Qt::AscendingOrder);
+                tableModel.sort(2, Qt::DescendingOrder);
+            });
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // Memo types have icons, and grid models need a GUI application,
+    // but nothing should be shown on the screen
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    app.setApplicationName("procyon_bench");
+    app.setApplicationVersion(APP_VER);
+
+    BenchParams params;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Procyon performance benchmark");
+    parser.addHelpOption();
+    QCommandLineOption optionFolders("folders", "Number of folders.", "count", QString::number(params.folders));
+    QCommandLineOption optionMemos("memos", "Number of memos.", "count", QString::number(params.memos));
+    QCommandLineOption optionProps("props", "Number of props per memo.", "count", QString::number(params.props));
+    QCommandLineOption optionSheets("sheets", "Number of sheets per memo.", "count", QString::number(params.sheets));
+    QCommandLineOption optionBodySize("body-size", "Memo text size in chars.", "chars", QString::number(params.bodySize));
+    QCommandLineOption optionIterations("iterations", "Number of runs of each benchmark.", "count", QString::number(params.iterations));
+    QCommandLineOption optionSamples("samples", "Number of memos to load and update per run.", "count", QString::number(params.samples));
+    QCommandLineOption optionSeed("seed", "Random seed of generated data.", "number", QString::number(params.seed));
+    QCommandLineOption optionFile("file", "Benchmark an existing notebook instead of generating one.", "path");
+    QCommandLineOption optionKeep("keep", "Save the generated notebook to the given path.", "path");
+    QCommandLineOption optionOutput("output", "Write JSON results to the file instead of stdout.", "path");
+    QCommandLineOption optionSqlStats("sql-stats", "Collect statistics of queries and add them to results.");
+    parser.addOptions({optionFolders, optionMemos, optionProps, optionSheets, optionBodySize,
+        optionIterations, optionSamples, optionSeed, optionFile, optionKeep, optionOutput, optionSqlStats});
+    parser.process(app);
+
+    params.folders = parser.value(optionFolders).toInt();
+    params.memos = parser.value(optionMemos).toInt();
+    params.props = parser.value(optionProps).toInt();
+    params.sheets = parser.value(optionSheets).toInt();
+    params.bodySize = parser.value(optionBodySize).toInt();
+    params.iterations = std::max(parser.value(optionIterations).toInt(), 1);
+    params.samples = parser.value(optionSamples).toInt();
+    params.seed = parser.value(optionSeed).toUInt();
+
+    QTemporaryDir tempDir;
+    QString fileName = parser.value(optionFile);
+    double generationMs = 0;
+    if (fileName.isEmpty())
+    {
+        fileName = parser.isSet(optionKeep)
+            ? parser.value(optionKeep)
+            : tempDir.filePath("bench." + Enot::defaultFileExt());
+        if (QFile::exists(fileName))
+            QFile::remove(fileName);
+
+        qInfo() << "Generating" << params.memos << "memos in" << params.folders << "folders...";
+        QElapsedTimer timer;
+        timer.start();
+        auto res = generateNotebook(fileName, params);
+        if (!res.isEmpty())
+        {
+            qCritical().noquote() << "Unable to generate notebook:" << res;
+            return 1;
+        }
+        generationMs = timer.nsecsElapsed() / 1e6;
+    }
+
+    // Generation is not counted in statistics, it's not what the app usually does
+    Ori::Sql::QueryStats::setEnabled(parser.isSet(optionSqlStats));
+
+    Bench bench(params);
+    int res = runBenchmarks(fileName, bench, params);
+    if (res != 0) return res;
+
+    auto report = bench.report(generationMs);
+    if (parser.isSet(optionSqlStats))
+        report["sql_stats"] = Ori::Sql::QueryStats::instance()->toJson();
+    auto json = QJsonDocument(report).toJson();
+    if (parser.isSet(optionOutput))
+    {
+        QFile file(parser.value(optionOutput));
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            qCritical().noquote() << "Unable to write results:" << file.errorString();
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
+}
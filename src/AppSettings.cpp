@@ -1,5 +1,7 @@
 #include "AppSettings.h"
 
+#include "core/Enot.h"
+
 #include "tools/OriSettings.h"
 
 #include <QFile>
@@ -111,6 +113,17 @@ void AppSettings::updateMarkdownCss(const QString css)
     NOTIFY_LISTENERS_1(optionChanged, AppSettingsOption::MARKDOWN_CSS);
 }
 
+StorageProfile AppSettings::storageProfile() const
+{
+    return {
+        .walMode = storageWalMode,
+        .cacheSizeMb = storageCacheSizeMb,
+        .mmapSizeMb = storageMmapSizeMb,
+        .checkpointIdleMs = storageCheckpointIdleSec * 1000,
+        .memoCacheSizeMb = memoCacheSizeMb,
+    };
+}
+
 AppSettings::Options AppSettings::options()
 {
     return {
@@ -130,6 +143,84 @@ AppSettings::Options AppSettings::options()
                     false,
                     &memoWordWrap
                     ),
+        new OptionSpec<int>(
+                    "Memo",
+                    "spellcheckCacheSize",
+                    "Spellcheck cache size, words",
+                    "How many checked words to remember to not check them again, "
+                    "0 disables remembering. Applied after restart",
+                    50000,
+                    &spellcheckCacheSize
+                    ),
+        new OptionSpec<bool>(
+                    "Memo",
+                    "spellcheckPersistCache",
+                    "Keep spellcheck cache",
+                    "Save remembered words near the user dictionary "
+                    "to not check them again in the next session",
+                    true,
+                    &spellcheckPersistCache
+                    ),
+        new OptionSpec<bool>(
+                    "Notebook",
+                    "preloadMemoProps",
+                    "Preload memo properties",
+                    "Load properties of all memos in one query when a notebook is opened",
+                    false,
+                    &preloadMemoProps
+                    ),
+        new OptionSpec<bool>(
+                    "Notebook",
+                    "progressiveOpen",
+                    "Progressive opening",
+                    "Show notebook folders immediately and load memos in background",
+                    true,
+                    &progressiveOpen
+                    ),
+        new OptionSpec<bool>(
+                    "Notebook",
+                    "storageWalMode",
+                    "Use write-ahead log",
+                    "Keep changes in a separate log file, saving is faster and doesn't block reading. "
+                    "Applied when a notebook is opened",
+                    true,
+                    &storageWalMode
+                    ),
+        new OptionSpec<int>(
+                    "Notebook",
+                    "storageCacheSizeMb",
+                    "Database cache size, MB",
+                    "Size of database page cache. Applied when a notebook is opened",
+                    16,
+                    &storageCacheSizeMb
+                    ),
+        new OptionSpec<int>(
+                    "Notebook",
+                    "storageMmapSizeMb",
+                    "Memory-mapped size, MB",
+                    "Size of notebook file part accessed via memory mapping, 0 disables mapping. "
+                    "Applied when a notebook is opened",
+                    256,
+                    &storageMmapSizeMb
+                    ),
+        new OptionSpec<int>(
+                    "Notebook",
+                    "storageCheckpointIdleSec",
+                    "Write-ahead log checkpoint delay, sec",
+                    "Idle time after the last change before the write-ahead log is merged into notebook file, "
+                    "0 disables merging until the notebook is closed",
+                    5,
+                    &storageCheckpointIdleSec
+                    ),
+        new OptionSpec<int>(
+                    "Notebook",
+                    "memoCacheSizeMb",
+                    "Memo cache size, MB",
+                    "Memory for texts of loaded memos. Texts of least recently used memos "
+                    "not opened in tabs are unloaded when the size is exceeded, 0 means no limit",
+                    256,
+                    &memoCacheSizeMb
+                    ),
         new OptionSpec<bool>(
                     "View",
                     "useNativeMenuBar",
@@ -11,6 +11,8 @@ QT_BEGIN_NAMESPACE
 class QSettings;
 QT_END_NAMESPACE
 
+struct StorageProfile;
+
 enum class AppSettingsOption
 {
     MARKDOWN_CSS
@@ -67,6 +69,16 @@ public:
     QFont memoFont; ///< Default font used to desplay memo content.
     bool memoWordWrap; ///< Whether memo texts should be wrapped by default.
 
+    bool preloadMemoProps; ///< Load properties of all memos in one query when a notebook is opened.
+    bool progressiveOpen; ///< Show notebook tree before all memos are loaded.
+    bool storageWalMode; ///< Use write-ahead log for notebook files.
+    int storageCacheSizeMb; ///< Size of database page cache.
+    int storageMmapSizeMb; ///< Size of memory-mapped region of notebook file.
+    int storageCheckpointIdleSec; ///< Idle time after the last change before write-ahead log is merged into notebook file.
+    int memoCacheSizeMb; ///< Memory budget for texts of loaded memos.
+    int spellcheckCacheSize; ///< Number of words whose spelling verdicts are remembered.
+    bool spellcheckPersistCache; ///< Keep remembered spelling verdicts between sessions.
+
     QString markdownCss();
     void updateMarkdownCss(const QString css);
 
@@ -75,6 +87,8 @@ public:
 
     Options options();
 
+    StorageProfile storageProfile() const;
+
 private:
     AppSettings() {}
     ~AppSettings() = delete;
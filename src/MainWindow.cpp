@@ -15,6 +15,7 @@
 #include "tabs/QssEditorTab.h"
 #include "tabs/CmdConsoleTab.h"
 #include "widgets/OpenTabsWidget.h"
+#include "widgets/SearchPanel.h"
 #include "widgets/TreeWidget.h"
 
 #ifdef ENABLE_SPELLCHECK
@@ -130,10 +131,20 @@ MainWindow::MainWindow() : QMainWindow()
     _treeView = new TreeWidget;
     connect(_treeView, &TreeWidget::memoOpenRequested, this, &MainWindow::openMemoTab);
 
+    _searchPanel = new SearchPanel;
+    _searchPanel->setVisible(false);
+    connect(_searchPanel, &SearchPanel::memoOpenRequested, this, &MainWindow::openMemoTab);
+
+    auto sidePanel = new QSplitter(Qt::Vertical);
+    sidePanel->addWidget(_searchPanel);
+    sidePanel->addWidget(_treeView);
+    sidePanel->setStretchFactor(0, 0);
+    sidePanel->setStretchFactor(1, 1);
+
     _splitter = new QSplitter;
     _splitter->addWidget(_openTabsView);
     _splitter->addWidget(_tabsView);
-    _splitter->addWidget(_treeView);
+    _splitter->addWidget(sidePanel);
     _splitter->setStretchFactor(0, 0);
     _splitter->setStretchFactor(1, 1);
     _splitter->setStretchFactor(2, 0);
@@ -211,6 +222,13 @@ void MainWindow::createMenu()
     _actionMemoExportPdf = m->addAction(tr("Export to PDF..."), this, &MainWindow::exportToPdf);
 
     m = menuBar()->addMenu(tr("Tools"));
+    connect(m, &QMenu::aboutToShow, this, &MainWindow::toolsMenuAboutToShow);
+
+    _actionSearch = m->addAction(tr("Search Memos"), QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_F), this, &MainWindow::toggleSearch);
+    _actionSearch->setCheckable(true);
+
+    _actionCompressData = m->addAction(tr("Compress Memo Texts"), this, &MainWindow::toggleDataCompression);
+    _actionCompressData->setCheckable(true);
 
     if (AppSettings::instance().isDevMode)
     {
@@ -373,7 +391,7 @@ void MainWindow::newEnot()
 
     if (!closeEnot()) return;
 
-    auto res = Enot::create(fileName);
+    auto res = Enot::create(fileName, AppSettings::instance().storageProfile());
     if (res.ok())
         enotOpened(res.result());
     else Ori::Dlg::error(tr("Unable to create notebook.\n\n%1").arg(res.error()));
@@ -388,7 +406,8 @@ void MainWindow::openEnot(const QString &fileName)
 
     if (!closeEnot()) return;
 
-    auto res = Enot::open(fileName);
+    auto& settings = AppSettings::instance();
+    auto res = Enot::open(fileName, settings.preloadMemoProps, settings.storageProfile(), settings.progressiveOpen);
     if (res.ok())
         enotOpened(res.result());
     else Ori::Dlg::error(tr("Unable to load notebook %1.\n\n%2").arg(fileName, res.error()));
@@ -411,6 +430,7 @@ void MainWindow::enotOpened(Enot* enot)
         Ori::Dlg::Defer::error(error);
     });
     _treeView->setEnot(_enot);
+    _searchPanel->setEnot(_enot);
     auto filePath = _enot->fileName();
     auto fileName = QFileInfo(filePath).fileName();
     setWindowTitle(fileName % " - " % qApp->applicationName());
@@ -418,8 +438,22 @@ void MainWindow::enotOpened(Enot* enot)
     _statusFileName->setText(QDir::toNativeSeparators(filePath));
     _lastOpenedDb = filePath;
     _highlighterControl->loadMetas();
-    updateCounter();
-    loadSession();
+
+    if (_enot->isLoading())
+    {
+        // The tree shows folders immediately and gets memos as they are loaded,
+        // but opened memos of the last session may not be there yet
+        _statusMemoCount->setText(tr("Loading..."));
+        connect(_enot, &Enot::loadingFinished, this, [this]{
+            updateCounter();
+            loadSession();
+        });
+    }
+    else
+    {
+        updateCounter();
+        loadSession();
+    }
 
     auto cmdConsole = findTab<CmdConsoleTab>(_tabsView);
     if (cmdConsole) cmdConsole->setEnot(_enot);
@@ -429,11 +463,17 @@ bool MainWindow::closeEnot()
 {
     if (_enot)
     {
-        saveSession();
+        // Session is not restored until all memos are loaded, don't overwrite it
+        if (!_enot->isLoading())
+            saveSession();
         if (!closeAllMemos()) return false;
         _treeView->setEnot(nullptr);
+        _searchPanel->setEnot(nullptr);
         delete _enot;
         _enot = nullptr;
+        // Pending loads are cancelled along with the notebook
+        _loadingMemoIds.clear();
+        _activeMemoId = 0;
     }
     setWindowTitle(qApp->applicationName());
     _statusFileName->setText(tr("(n/a)"));
@@ -489,14 +529,51 @@ void MainWindow::closeEvent(QCloseEvent *event)
     event->accept();
 }
 
+void MainWindow::toggleSearch()
+{
+    _searchPanel->setVisible(_actionSearch->isChecked());
+    if (_searchPanel->isVisible())
+        _searchPanel->activate();
+}
+
 void MainWindow::openMemoTab(Memo* memo)
 {
-    if (!memo->isLoaded())
+    // The last requested memo should be active when all pending memos are loaded
+    _activeMemoId = memo->id();
+
+    if (memo->isLoaded())
     {
-        auto res = _enot->loadMemo(memo);
-        if (!res.isEmpty()) return Ori::Dlg::error(res);
+        showMemoTab(memo);
+        return;
     }
 
+    int memoId = memo->id();
+    if (_loadingMemoIds.contains(memoId))
+        return;
+    _loadingMemoIds << memoId;
+
+    // Large memos can take a while to load, it's done in the storage thread
+    _enot->loadMemoAsync(memo).then(this, [this, memoId](const QString& res){
+        _loadingMemoIds.remove(memoId);
+
+        if (!res.isEmpty())
+            return Ori::Dlg::error(res);
+
+        auto memo = _enot->findMemoById(memoId);
+        if (!memo) return;
+        showMemoTab(memo);
+
+        if (_activeMemoId != memoId)
+        {
+            auto activeMemo = _enot->findMemoById(_activeMemoId);
+            if (activeMemo && findMemoTab(activeMemo))
+                showMemoTab(activeMemo);
+        }
+    });
+}
+
+void MainWindow::showMemoTab(Memo* memo)
+{
     auto existedPage = findMemoTab(memo);
     if (existedPage)
     {
@@ -632,6 +709,34 @@ void MainWindow::memoMenuAboutToShow()
     _actionAddMemoProp->setEnabled(memoPage && memoPage->canHaveProps() && !memoPage->isReadOnly());
 }
 
+void MainWindow::toolsMenuAboutToShow()
+{
+    _actionCompressData->setEnabled(_enot && !_isRecoding);
+    _actionCompressData->setChecked(_enot && _enot->isDataCompressed());
+}
+
+void MainWindow::toggleDataCompression()
+{
+    if (!_enot) return;
+
+    bool on = _actionCompressData->isChecked();
+    if (!Ori::Dlg::yes(on
+        ? tr("Memo texts will be stored compressed. Existing memos are going to be compressed now, "
+             "it can take a while for a large notebook. Continue?")
+        : tr("Memo texts will be stored uncompressed. Existing memos are going to be decompressed now, "
+             "it can take a while for a large notebook. Continue?")))
+        return;
+
+    _isRecoding = true;
+    statusBar()->showMessage(on ? tr("Compressing memos...") : tr("Decompressing memos..."));
+    _enot->setDataCompressed(on).then(this, [this](const QString& res){
+        _isRecoding = false;
+        statusBar()->clearMessage();
+        if (!res.isEmpty())
+            Ori::Dlg::error(res);
+    });
+}
+
 void MainWindow::spellcheckMenuAboutToShow()
 {
 #ifdef ENABLE_SPELLCHECK
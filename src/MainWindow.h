@@ -2,6 +2,7 @@
 #define MAIN_WINDOW_H
 
 #include <QMainWindow>
+#include <QSet>
 
 QT_BEGIN_NAMESPACE
 class QAction;
@@ -13,6 +14,7 @@ QT_END_NAMESPACE
 
 class Enot;
 class Entry;
+class SearchPanel;
 class TreeWidget;
 class OpenTabsWidget;
 class SpellcheckControl;
@@ -48,16 +50,21 @@ private:
     QSplitter* _splitter;
     Enot* _enot = nullptr;
     TreeWidget* _treeView;
+    SearchPanel* _searchPanel;
     QStackedWidget* _tabsView;
     OpenTabsWidget* _openTabsView;
     Ori::MruFileList *_mruList;
     QLabel *_statusMemoCount, *_statusFileName;
     QAction *_actionMemoFont, *_actionWordWrap, *_actionMemoExportPdf, *_actionAddMemoProp;
+    QAction *_actionSearch, *_actionCompressData;
     QString _lastOpenedDb;
     SpellcheckControl* _spellcheckControl;
     Phl::Control* _highlighterControl;
     QMenu *_spellcheckMenu = nullptr;
     QMenu *_highlighterMenu;
+    QSet<int> _loadingMemoIds;
+    int _activeMemoId = 0;
+    bool _isRecoding = false;
 
     void createMenu();
     void createStatusBar();
@@ -74,6 +81,8 @@ private:
     void chooseMemoFont();
     void toggleWordWrap();
     void addMemoProp();
+    void toggleSearch();
+    void toggleDataCompression();
 
     void enotOpened(Enot* enot);
     void itemCreated(Entry* entry);
@@ -81,6 +90,7 @@ private:
 
     bool closeAllMemos();
     void openMemoTab(Memo* memo);
+    void showMemoTab(Memo* memo);
     void exportToPdf();
 
     MemoTab* findMemoTab(Memo* memo) const;
@@ -88,6 +98,7 @@ private:
     TextMemoTab* currentTextMemoTab() const;
 
     void memoMenuAboutToShow();
+    void toolsMenuAboutToShow();
     void spellcheckMenuAboutToShow();
     void highlighterMenuAboutToShow();
 
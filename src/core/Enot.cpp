@@ -1,16 +1,38 @@
 #include "Enot.h"
 
 #include "FolderStore.h"
+#include "MemoBodyCache.h"
 #include "MemoStore.h"
 #include "SettingsStore.h"
 #include "SqlHelper.h"
+#include "StorageWorker.h"
 
 #include <QDebug>
 #include <QFile>
 #include <QSqlDatabase>
+#include <QTimeZone>
+#include <QTimer>
 #include <QUuid>
 
+#include <memory>
+
 #define KEY_UID "UID"
+#define KEY_COMPRESS_DATA "CompressData"
+
+namespace {
+
+// Number of memos loaded in one step when a notebook is opened progressively
+const int MEMO_CHUNK_SIZE = 2000;
+// Large memos are reindexed for search when there were no saves for this time
+const int REINDEX_IDLE_MS = 5000;
+// Number of rows rewritten in one transaction when compression mode is changed
+const int RECODE_BATCH_SIZE = 500;
+// Number of memos deleted in one transaction when a folder branch is deleted
+const int REMOVE_BATCH_SIZE = 500;
+// Number of memos indexed in one transaction when the search index is filled
+const int SEARCH_FILL_BATCH_SIZE = 500;
+
+} // namespace
 
 //------------------------------------------------------------------------------
 //                                Entry
@@ -50,6 +72,45 @@ Folder::~Folder()
 
 Memo::~Memo()
 {
+    MemoBodyCache::instance()->forget(this);
+}
+
+QString Memo::data() const
+{
+    auto self = const_cast<Memo*>(this);
+    if (!_isLoaded)
+    {
+        auto res = Store::memos()->load(self);
+        if (!res.isEmpty())
+            qWarning() << "Unable to load memo" << id() << res;
+    }
+    MemoBodyCache::instance()->touch(self);
+    return _data;
+}
+
+QDateTime Memo::created() const
+{
+    return msecsToTime(_created);
+}
+
+QDateTime Memo::updated() const
+{
+    return msecsToTime(_updated);
+}
+
+QDateTime Memo::msecsToTime(qint64 msecs)
+{
+    if (msecs == 0)
+        return QDateTime();
+    auto utc = QDateTime::fromMSecsSinceEpoch(msecs, QTimeZone::UTC);
+    return QDateTime(utc.date(), utc.time());
+}
+
+qint64 Memo::timeToMsecs(const QDateTime& time)
+{
+    if (!time.isValid())
+        return 0;
+    return QDateTime(time.date(), time.time(), QTimeZone::UTC).toMSecsSinceEpoch();
 }
 
 const QHash<QString, QString>& Memo::props()
@@ -73,7 +134,44 @@ QString Enot::defaultFileExt()
     return QStringLiteral("enot");
 }
 
-QString Enot::prepareStore(const QString fileName)
+QString Enot::applyStorageProfile(const StorageProfile& profile)
+{
+    using namespace Ori::Sql;
+
+    // Journal mode can't be changed inside of a transaction, so it's not a part of store preparation
+    if (profile.walMode)
+    {
+        SelectQuery query("PRAGMA journal_mode = WAL");
+        if (query.isFailed())
+            return QString("Failed to enable write-ahead log.\n\n%1").arg(query.error());
+
+        // SQLite keeps the old mode when WAL is not supported, e.g. for some network file systems
+        if (query.next() && query.record().value(0).toString().toLower() != "wal")
+            qWarning() << "Write-ahead log is not supported for the notebook, journal mode is"
+                       << query.record().value(0).toString();
+    }
+
+    // In WAL mode, NORMAL is still durable against application crashes
+    // and doesn't sync on every commit, only on checkpoints
+    QStringList pragmas {
+        QString("PRAGMA synchronous = %1").arg(profile.walMode ? "NORMAL" : "FULL"),
+        // Negative value means size in KiB rather than in pages
+        QString("PRAGMA cache_size = %1").arg(-1024 * profile.cacheSizeMb),
+        QString("PRAGMA mmap_size = %1").arg(qint64(profile.mmapSizeMb) * 1024 * 1024),
+        QString("PRAGMA busy_timeout = %1").arg(profile.busyTimeoutMs),
+        QStringLiteral("PRAGMA temp_store = MEMORY"),
+    };
+    for (const auto& pragma : std::as_const(pragmas))
+    {
+        SelectQuery query(pragma);
+        if (query.isFailed())
+            return QString("Failed to configure database.\n\n%1").arg(query.error());
+    }
+
+    return QString();
+}
+
+QString Enot::prepareStore(const QString fileName, const StorageProfile& profile)
 {
     auto db = QSqlDatabase::database();
 
@@ -81,7 +179,10 @@ QString Enot::prepareStore(const QString fileName)
         db = QSqlDatabase::addDatabase("QSQLITE");
 
     if (db.isOpen())
+    {
+        Ori::Sql::StatementCache::clear();
         db.close();
+    }
 
     db.setDatabaseName(fileName);
 
@@ -94,13 +195,15 @@ QString Enot::prepareStore(const QString fileName)
         return QString("Failed to enable foreign keys.\n\n%1")
                 .arg(SqlHelper::errorText(query));
 
+    auto res = applyStorageProfile(profile);
+    if (!res.isEmpty())
+        return res;
+
     bool ok = db.transaction();
     if (!ok)
         return QString("Failed to begin transaction for setup database structure.\n\n%1")
                 .arg(SqlHelper::errorText(db.lastError()));
 
-    QString res;
-
     res = Store::folders()->prepare();
     if (!res.isEmpty()) return res;
 
@@ -110,17 +213,19 @@ QString Enot::prepareStore(const QString fileName)
     res = Store::settings()->prepare();
     if (!res.isEmpty()) return res;
 
+    Store::memos()->setCompressionEnabled(Store::settings()->readBool(KEY_COMPRESS_DATA, false));
+
     db.commit();
     return QString();
 }
 
-EnotResult Enot::open(const QString& fileName)
+EnotResult Enot::open(const QString& fileName, bool preloadProps, const StorageProfile& profile, bool progressive)
 {
-    QString res = prepareStore(fileName);
+    QString res = prepareStore(fileName, profile);
     if (!res.isEmpty())
         return EnotResult::fail(res);
 
-    Enot* enot = new Enot(fileName);
+    Enot* enot = new Enot(fileName, profile);
 
     // Load folders
     {
@@ -145,10 +250,28 @@ EnotResult Enot::open(const QString& fileName)
             }
 
             item.folder->_parent = parent;
-            parent->_folders.append(item.folder);
+            appendChild(parent->_folders, item.folder);
         }
     }
 
+    if (progressive)
+    {
+        // Memos are streamed in chunks when the caller has got the notebook
+        // and connected to its signals, see loadNextMemos()
+        // Memos created while loading get greater ids and are already in the tree,
+        // so only memos existing at this moment are loaded
+        res = Store::memos()->maxId(&enot->_lastMemoIdToLoad);
+        if (!res.isEmpty())
+        {
+            delete enot;
+            return EnotResult::fail(res);
+        }
+        enot->_isLoading = true;
+        enot->_preloadPropsWhenLoaded = preloadProps;
+        QTimer::singleShot(0, enot, &Enot::loadNextMemos);
+        return EnotResult::ok(enot);
+    }
+
     // Load memos
     {
         MemosResult res = Store::memos()->selectAll();
@@ -162,49 +285,90 @@ EnotResult Enot::open(const QString& fileName)
             for (const auto &warning: std::as_const(res.warnings))
                 qWarning() << warning; // TODO make protocol window
 
-        for (const auto& item : std::as_const(res.items))
-        {
-            auto folder = enot->_allFolders.value(item.folderId);
-            if (!folder)
-            {
-                folder = enot->root();
-                qWarning() << QString("Folder #%1 not found for memo #%2, reparented to the root")
-                                  .arg(item.folderId).arg(item.memo->id());
-            }
-
-            item.memo->_parent = folder;
-            folder->_memos.append(item.memo);
-            enot->_allMemos[item.memo->id()] = item.memo;
-        }
+        enot->appendMemos(res, false);
     }
 
+    // Load props of all memos in a single pass instead of one query per memo
+    if (preloadProps)
+        enot->preloadProps();
+
     return EnotResult::ok(enot);
 }
 
-EnotResult Enot::create(const QString& fileName)
+EnotResult Enot::create(const QString& fileName, const StorageProfile& profile)
 {
-    if (QFile::exists(fileName) && !QFile::remove(fileName))
-        return EnotResult::fail("Unable to overwrite existing file, probably it is locked.");
+    // Journal files left by a crashed session would be recovered into the new database
+    for (const QString& name : {fileName, fileName + "-wal", fileName + "-shm", fileName + "-journal"})
+        if (QFile::exists(name) && !QFile::remove(name))
+            return EnotResult::fail(QString("Unable to overwrite existing file %1, probably it is locked.").arg(name));
 
-    QString res = prepareStore(fileName);
+    QString res = prepareStore(fileName, profile);
     if (!res.isEmpty())
         return EnotResult::fail(res);
 
-    Enot* enot = new Enot(fileName);
+    Enot* enot = new Enot(fileName, profile);
 
     return EnotResult::ok(enot);
 }
 
-Enot::Enot(const QString& fileName) : QObject(), _fileName(fileName)
+Enot::Enot(const QString& fileName, const StorageProfile& profile) : QObject(), _fileName(fileName), _profile(profile)
 {
     _root._id = 0;
     _root._title = QFileInfo(fileName).baseName();
     _allFolders.insert(_root.id(), &_root);
     _station = QSysInfo::machineHostName();
+
+    _worker = new StorageWorker(fileName, profile);
+
+    MemoBodyCache::instance()->setBudget(qint64(profile.memoCacheSizeMb) * 1024 * 1024);
+
+    if (_profile.walMode && _profile.checkpointIdleMs > 0)
+    {
+        _checkpointTimer = new QTimer(this);
+        _checkpointTimer->setSingleShot(true);
+        _checkpointTimer->setInterval(_profile.checkpointIdleMs);
+        connect(_checkpointTimer, &QTimer::timeout, this, &Enot::checkpoint);
+    }
+
+    _reindexTimer = new QTimer(this);
+    _reindexTimer->setSingleShot(true);
+    _reindexTimer->setInterval(REINDEX_IDLE_MS);
+    connect(_reindexTimer, &QTimer::timeout, this, &Enot::reindexStale);
+
+    // Search index of a notebook opened for the first time after search was added
+    // or after FTS5 was not available is filled in background
+    fillSearchIndex();
 }
 
 Enot::~Enot()
 {
+    // Wait for pending jobs and close the worker's connection
+    delete _worker;
+
+    // Don't leave the search index outdated for memos saved just before closing
+    QString res = Store::memos()->reindexStale();
+    if (!res.isEmpty())
+        qWarning() << "Unable to update search index" << res;
+
+    MemoBodyCache::instance()->clear();
+
+    Ori::Sql::StatementCache::clear();
+
+    if (_profile.walMode)
+    {
+        // Move all changes into the main file and drop the WAL,
+        // so a closed notebook is a single file again, e.g. when it's synced via a cloud folder
+        Ori::Sql::SelectQuery checkpoint("PRAGMA wal_checkpoint(TRUNCATE)");
+        if (checkpoint.isFailed())
+            qWarning() << "Failed to checkpoint WAL" << checkpoint.error();
+        else
+        {
+            Ori::Sql::SelectQuery journal("PRAGMA journal_mode = DELETE");
+            if (journal.isFailed())
+                qWarning() << "Failed to reset journal mode" << journal.error();
+        }
+    }
+
     // Don't clear _allMemos and _allFolders explicitly
     // All entries will be freed when the root folder is deleted
 }
@@ -218,9 +382,10 @@ bool Enot::renameFolder(Folder* folder, const QString& title)
         return false;
     }
 
+    rememberEntry(folder);
     folder->_title = title;
 
-    emit entryUpdated(folder);
+    notifyUpdated(folder);
 
     // TODO sort items after renaming
     return true;
@@ -249,10 +414,12 @@ FolderResult Enot::createFolder(Folder* parent, const QString& title)
 
     emit entryCreating(folder, parent->_folders.size());
 
-    parent->_folders.append(folder);
+    appendChild(parent->_folders, folder);
     _allFolders.insert(folder->id(), folder);
     // TODO sort items after inserting
 
+    scheduleCheckpoint();
+
     emit entryCreated(folder);
     return FolderResult::ok(folder);
 }
@@ -266,12 +433,6 @@ bool Enot::deleteFolder(Folder* folder)
         return false;
     }
 
-    QVector<int> folderIds;
-    fillFolderIdsFlat(folder, folderIds);
-
-    QVector<int> memoIds;
-    fillMemoIdsFlat(folder, memoIds);
-
     // It removes all subfolders too
     QString res = Store::folders()->remove(folder);
     if (!res.isEmpty())
@@ -280,11 +441,139 @@ bool Enot::deleteFolder(Folder* folder)
         return false;
     }
 
+    removeFolderEntries(folder);
+    return true;
+}
+
+QFuture<bool> Enot::deleteFolderAsync(Folder* folder)
+{
+    if (!folder->parent())
+    {
+        QString msg = "Unable to remove root folder";
+        emit errorOccurred(msg);
+        return QtFuture::makeReadyValueFuture(false);
+    }
+
+    // Memos of the branch are deleted by portions, each in its own transaction.
+    // The GUI thread writes to the same file via another connection, and SQLite allows
+    // only one writer at a time, so a single transaction over a large branch would
+    // make saves wait for it and fail on the busy timeout
+    int folderId = folder->id();
+    auto queue = std::make_shared<RemoveQueue>();
+    auto promise = std::make_shared<QPromise<bool>>();
+    auto future = promise->future();
+    promise->start();
+    _worker->run<QString>([folderId, queue]{
+        return Store::memos()->selectBranchMemos(folderId, *queue);
+    }).then(this, [this, folderId, queue, promise](const QString& res){
+        if (!res.isEmpty())
+        {
+            emit errorOccurred(res);
+            promise->addResult(false);
+            promise->finish();
+            return;
+        }
+        removeBranchNext(folderId, queue, promise);
+    });
+    return future;
+}
+
+void Enot::removeBranchNext(int folderId, std::shared_ptr<RemoveQueue> queue, std::shared_ptr<QPromise<bool>> promise)
+{
+    if (queue->isDone())
+    {
+        removeBranchFolders(folderId).then([promise](bool ok){
+            promise->addResult(ok);
+            promise->finish();
+        });
+        return;
+    }
+
+    qsizetype startPos = queue->memoPos;
+    _worker->run<QString>([queue]{
+        return Store::memos()->removeNext(*queue, REMOVE_BATCH_SIZE);
+    }).then(this, [this, folderId, queue, promise, startPos](const QString& res){
+        // Memos of committed portions are gone from DB, remove them from the tree right away,
+        // so it's still consistent with DB if a next portion fails
+        for (qsizetype i = startPos; i < queue->memoPos; i++)
+        {
+            auto memo = _allMemos.value(queue->memoIds.at(i));
+            if (memo)
+                removeMemoEntry(memo);
+        }
+
+        if (!res.isEmpty())
+        {
+            emit errorOccurred(res);
+            promise->addResult(false);
+            promise->finish();
+            return;
+        }
+        removeBranchNext(folderId, queue, promise);
+    });
+}
+
+QFuture<bool> Enot::removeBranchFolders(int folderId)
+{
+    auto removedIds = std::make_shared<QVector<int>>();
+    return _worker->run<QString>([folderId, removedIds]{
+        // The branch is collected in the worker, subfolders can be created before it starts.
+        // Memos created in the branch meanwhile are few, they are deleted by FK relation
+        return Store::folders()->removeBranch(folderId, removedIds.get());
+    }).then(this, [this, folderId, removedIds](const QString& res){
+        if (!res.isEmpty())
+        {
+            emit errorOccurred(res);
+            return false;
+        }
+        auto folder = _allFolders.value(folderId);
+        if (!folder)
+            return true;
+
+        // Subfolders created after the worker has finished are still in DB
+        QVector<int> branchIds;
+        fillFolderIdsFlat(folder, branchIds);
+        QVector<int> remainingIds;
+        for (auto id : std::as_const(branchIds))
+            if (!removedIds->contains(id))
+                remainingIds << id;
+        if (!remainingIds.isEmpty())
+        {
+            QString res = Store::folders()->remove(remainingIds);
+            if (!res.isEmpty())
+            {
+                emit errorOccurred(res);
+                return false;
+            }
+        }
+
+        removeFolderEntries(folder);
+        return true;
+    });
+}
+
+void Enot::removeFolderEntries(Folder* folder)
+{
+    QVector<int> folderIds;
+    fillFolderIdsFlat(folder, folderIds);
+
+    if (_isLoading)
+    {
+        // Memos of these folders can be still in the pipeline
+        _removedFolderIds << folder->id();
+        for (auto id : std::as_const(folderIds))
+            _removedFolderIds << id;
+    }
+
+    QVector<int> memoIds;
+    fillMemoIdsFlat(folder, memoIds);
+
     emit entryDeleting(folder);
 
     for (auto id : std::as_const(memoIds))
     {
         auto memo = _allMemos.value(id);
+        forgetUpdated(memo);
         emit entryDeleting(memo);
 
         // Memo in DB was already deleted by FK relation
@@ -293,15 +582,20 @@ bool Enot::deleteFolder(Folder* folder)
         emit entryDeleted(memo);
     }
 
-    folder->parent()->_folders.removeOne(folder);
+    removeChild(folder->parent()->_folders, folder);
 
     for (auto id : std::as_const(folderIds))
+    {
+        forgetUpdated(_allFolders.value(id));
         _allFolders.remove(id);
+    }
 
+    forgetUpdated(folder);
     _allFolders.remove(folder->id());
 
     delete folder;
-    return true;
+
+    scheduleCheckpoint();
 }
 
 MemoResult Enot::createMemo(Folder* folder, MemoType* memoType)
@@ -310,10 +604,12 @@ MemoResult Enot::createMemo(Folder* folder, MemoType* memoType)
 
     auto memo = new Memo;
     memo->_parent = folder;
-    memo->_created = now;
-    memo->_updated = now;
+    memo->_created = Memo::timeToMsecs(now);
+    memo->_updated = memo->_created;
     memo->_station = _station;
     memo->_type = memoType;
+    // New memo is empty, nothing to load
+    memo->_isLoaded = true;
 
     auto res = Store::memos()->create(memo);
     if (!res.isEmpty())
@@ -325,10 +621,12 @@ MemoResult Enot::createMemo(Folder* folder, MemoType* memoType)
 
     emit entryCreating(memo, folder->_memos.size());
 
-    folder->_memos.append(memo);
+    appendChild(folder->_memos, memo);
     _allMemos.insert(memo->id(), memo);
     // TODO sort items after inserting
 
+    scheduleCheckpoint();
+
     emit entryCreated(memo);
     return MemoResult::ok(memo);
 }
@@ -341,68 +639,167 @@ bool Enot::updateMemo(Memo* memo, MemoUpdateParam update)
     update.moment = QDateTime::currentDateTime();
     update.station = _station;
 
-    QString res = Store::memos()->update(memo, update);
+    QString res = writeMemo(memo->id(), update, update.props ? memo->props() : QHash<QString, QString>());
     if (!res.isEmpty())
     {
         emit errorOccurred(res);
         return false;
     }
 
-    if (update.title)
-        memo->_title = *update.title;
-    if (update.data)
-        memo->_data = *update.data;
-    memo->_updated = *update.moment;
-    memo->_station = *update.station;
+    rememberEntry(memo);
+    applyMemoUpdate(memo, update);
+    return true;
+}
 
-    if (update.props)
+QFuture<bool> Enot::updateMemoAsync(Memo* memo, MemoUpdateParam update)
+{
+    bool isEmpty = update.IsEmpty();
+    if (!isEmpty)
     {
-        QStringList errors;
+        update.moment = QDateTime::currentDateTime();
+        update.station = _station;
+    }
 
-        auto names = memo->props().keys();
-        for (const auto& name : std::as_const(names))
-        {
-            if (!update.props->contains(name))
-            {
-                auto err = Store::memos()->deleteProp(memo->id(), name);
-                if (!err.isEmpty())
-                    errors << err;
-                else
-                    memo->_props->remove(name);
-            }
-        }
+    int memoId = memo->id();
+    // Old props are needed to know which of them should be deleted,
+    // get them here since the memo can't be touched from the worker
+    auto oldProps = update.props ? memo->props() : QHash<QString, QString>();
 
-        for (auto it = update.props->cbegin(); it != update.props->cend(); it++)
+    return _worker->run<QString>([memoId, update, oldProps, isEmpty]{
+        return isEmpty ? QString() : writeMemo(memoId, update, oldProps);
+    }).then(this, [this, memoId, update, isEmpty](const QString& res){
+        if (!res.isEmpty())
         {
-            auto name = it.key();
-            auto value = it.value();
-            if (value != memo->_props->value(name))
-            {
-                auto err = Store::memos()->updateProp(memo->id(), name, value);
-                if (!err.isEmpty())
-                    errors << err;
-                else
-                    memo->_props->insert(name, value);
-            }
+            emit errorOccurred(res);
+            return false;
         }
+        auto memo = _allMemos.value(memoId);
+        if (!memo)
+            return false; // Deleted while saving
+        if (!isEmpty)
+            applyMemoUpdate(memo, update);
+        return true;
+    });
+}
 
-        if (!errors.isEmpty())
-        {
-            emit errorOccurred(errors.join('\n'));
-            // Don't return false here,
-            // since the memo itself is saved successfully
-        }
+QString Enot::writeMemo(int memoId, const MemoUpdateParam& update, const QHash<QString, QString>& oldProps)
+{
+    // The memo row and all its props are written in a single transaction
+    // (or a savepoint when called inside of a batch) instead of autocommitting each statement
+    QString res = Ori::Sql::beginTransaction();
+    if (!res.isEmpty())
+        return res;
+
+    res = Store::memos()->update(memoId, update);
+
+    if (res.isEmpty() && update.props)
+    {
+        for (auto it = oldProps.cbegin(); it != oldProps.cend() && res.isEmpty(); it++)
+            if (!update.props->contains(it.key()))
+                res = Store::memos()->deleteProp(memoId, it.key());
+
+        for (auto it = update.props->cbegin(); it != update.props->cend() && res.isEmpty(); it++)
+            if (!oldProps.contains(it.key()) || oldProps.value(it.key()) != it.value())
+                res = Store::memos()->updateProp(memoId, it.key(), it.value());
     }
 
-    emit entryUpdated(memo);
+    if (!res.isEmpty())
+    {
+        Ori::Sql::rollbackTransaction();
+        return res;
+    }
+
+    return Ori::Sql::commitTransaction();
+}
+
+void Enot::applyMemoUpdate(Memo* memo, const MemoUpdateParam& update)
+{
+    if (update.title)
+        memo->_title = *update.title;
+    if (update.data)
+    {
+        memo->_data = *update.data;
+        MemoBodyCache::instance()->touch(memo);
+    }
+    if (update.props)
+        memo->_props = *update.props;
+    memo->_updated = Memo::timeToMsecs(*update.moment);
+    memo->_station = *update.station;
+
+    // Restarting the timer on every save postpones reindexing until the user stops editing
+    if ((update.data || update.title) && Store::memos()->hasStaleSearchIndex())
+        _reindexTimer->start();
+
+    notifyUpdated(memo);
 
     // TODO sort memos after renaming
-    return true;
 }
 
 QString Enot::loadMemo(Memo* memo)
 {
-    return Store::memos()->load(memo);
+    auto res = Store::memos()->load(memo);
+    if (res.isEmpty())
+        MemoBodyCache::instance()->touch(memo);
+    return res;
+}
+
+QFuture<QString> Enot::loadMemoAsync(Memo* memo)
+{
+    int memoId = memo->id();
+    return _worker->run<MemoDataResult>([memoId]{
+        return Store::memos()->loadData(memoId);
+    }).then(this, [this, memoId](const MemoDataResult& res){
+        if (!res.error.isEmpty())
+            return res.error;
+        auto memo = _allMemos.value(memoId);
+        if (!memo)
+            return QString("Memo #%1 has been deleted while loading.").arg(memoId);
+        // The memo could be saved while loading, then its data is newer than loaded one
+        if (!memo->_isLoaded)
+        {
+            memo->_data = res.data;
+            memo->_isLoaded = true;
+        }
+        MemoBodyCache::instance()->touch(memo);
+        return QString();
+    });
+}
+
+void Enot::prefetchMemos(const QList<Memo*>& memos)
+{
+    QVector<int> ids;
+    for (auto memo : memos)
+        if (!memo->_isLoaded && !_prefetchingIds.contains(memo->id()))
+            ids << memo->id();
+    if (ids.isEmpty())
+        return;
+
+    for (int id : std::as_const(ids))
+        _prefetchingIds << id;
+
+    _worker->run<MemosDataResult>([ids]{
+        return Store::memos()->loadDataMany(ids);
+    }).then(this, [this, ids](const MemosDataResult& res){
+        for (int id : ids)
+            _prefetchingIds.remove(id);
+
+        if (!res.error.isEmpty())
+        {
+            qWarning() << "Unable to prefetch memos" << res.error;
+            return;
+        }
+
+        for (auto it = res.data.cbegin(); it != res.data.cend(); it++)
+        {
+            auto memo = _allMemos.value(it.key());
+            // The memo could be deleted, or loaded or saved while prefetching
+            if (!memo || memo->_isLoaded)
+                continue;
+            memo->_data = it.value();
+            memo->_isLoaded = true;
+            MemoBodyCache::instance()->touch(memo);
+        }
+    });
 }
 
 bool Enot::deleteMemo(Memo* memo)
@@ -414,15 +811,24 @@ bool Enot::deleteMemo(Memo* memo)
         return false;
     }
 
+    removeMemoEntry(memo);
+    return true;
+}
+
+void Enot::removeMemoEntry(Memo* memo)
+{
+    forgetUpdated(memo);
+
     emit entryDeleting(memo);
 
-    memo->parent()->_memos.removeOne(memo);
+    removeChild(memo->parent()->_memos, memo);
     _allMemos.remove(memo->id());
 
     emit entryDeleted(memo);
 
     delete memo;
-    return true;
+
+    scheduleCheckpoint();
 }
 
 IntResult Enot::countMemos() const
@@ -435,19 +841,17 @@ IntResult Enot::countMemos() const
 namespace {
 
 template <typename TItem>
-TItem* findInContainerById(const QMap<int, TItem*>& container, int id)
+TItem* findInContainerById(const EntryIndex<TItem>& container, int id)
 {
     if (id <= 0)
     {
         qCritical() << "Invalid folder or memo id" << id;
         return nullptr;
     }
-    if (!container.contains(id))
-    {
+    auto item = container.value(id);
+    if (!item)
         qCritical() << "Inconsistent state! Db does not contain folder or memo" << id;
-        return nullptr;
-    }
-    return container[id];
+    return item;
 }
 
 } // namespace
@@ -462,6 +866,23 @@ Folder* Enot::findFolderById(int id) const
     return findInContainerById(_allFolders, id);
 }
 
+template <typename TEntry>
+void Enot::appendChild(QList<TEntry*>& children, TEntry* entry)
+{
+    entry->_row = children.size();
+    children.append(entry);
+}
+
+template <typename TEntry>
+void Enot::removeChild(QList<TEntry*>& children, TEntry* entry)
+{
+    int row = entry->_row;
+    Q_ASSERT(children.at(row) == entry);
+    children.removeAt(row);
+    for (int i = row; i < children.size(); i++)
+        children.at(i)->_row = i;
+}
+
 void Enot::fillFolderIdsFlat(Folder* root, QVector<int>& ids)
 {
     for (auto folder : root->folders())
@@ -480,6 +901,56 @@ void Enot::fillMemoIdsFlat(Folder* root, QVector<int> &ids)
         fillMemoIdsFlat(folder, ids);
 }
 
+bool Enot::isDataCompressed() const
+{
+    return Store::memos()->isCompressionEnabled();
+}
+
+QFuture<QString> Enot::setDataCompressed(bool on)
+{
+    auto res = Store::settings()->writeBool(KEY_COMPRESS_DATA, on);
+    if (!res.isEmpty())
+        return QtFuture::makeReadyValueFuture(res);
+
+    Store::memos()->setCompressionEnabled(on);
+
+    // Existing texts are rewritten in the storage thread, it takes a while for a large notebook.
+    // The file doesn't shrink until it's vacuumed, but freed pages are reused for new data
+    auto queue = std::make_shared<RecodeQueue>();
+    auto promise = std::make_shared<QPromise<QString>>();
+    auto future = promise->future();
+    promise->start();
+    _worker->run<QString>([queue]{
+        return Store::memos()->selectRecodable(*queue);
+    }).then(this, [this, queue, promise](const QString& res){
+        if (!res.isEmpty())
+        {
+            promise->addResult(res);
+            promise->finish();
+            return;
+        }
+        recodeNext(queue, promise);
+    });
+    return future;
+}
+
+void Enot::recodeNext(std::shared_ptr<RecodeQueue> queue, std::shared_ptr<QPromise<QString>> promise)
+{
+    // Each portion is a separate job and transaction, so saves and other writes
+    // requested meanwhile are done between portions instead of waiting for the whole run
+    _worker->run<QString>([queue]{
+        return Store::memos()->recodeNext(*queue, RECODE_BATCH_SIZE);
+    }).then(this, [this, queue, promise](const QString& res){
+        if (!res.isEmpty() || queue->isDone())
+        {
+            promise->addResult(res);
+            promise->finish();
+            return;
+        }
+        recodeNext(queue, promise);
+    });
+}
+
 QString Enot::uid() const
 {
     return Store::settings()->readString(KEY_UID);
@@ -496,6 +967,338 @@ QString Enot::getOrMakeUid()
     return uid;
 }
 
+void Enot::preloadProps(Folder* folder)
+{
+    if (folder)
+    {
+        // Don't query if all the folder's memos already have their props
+        bool hasUnloaded = false;
+        for (auto memo : folder->memos())
+            if (!memo->_props)
+            {
+                hasUnloaded = true;
+                break;
+            }
+        if (!hasUnloaded) return;
+    }
+
+    auto res = folder
+        ? Store::memos()->loadFolderProps(folder->id())
+        : Store::memos()->loadAllProps();
+    if (!res.error.isEmpty())
+    {
+        // Props will be loaded lazily memo by memo
+        qWarning() << "Unable to preload memo props" << res.error;
+        return;
+    }
+
+    auto fill = [&res](Memo* memo){
+        if (!memo->_props)
+            memo->_props = res.items.take(memo->id());
+    };
+    if (folder)
+    {
+        for (auto memo : folder->memos())
+            fill(memo);
+    }
+    else
+    {
+        _allMemos.forEach(fill);
+    }
+}
+
+bool Enot::beginBatch()
+{
+    QString res = Ori::Sql::beginTransaction();
+    if (!res.isEmpty())
+    {
+        // Still count the level to keep begin/commit calls balanced,
+        // mutations will be written by the enclosing transaction or autocommitted one by one
+        qWarning() << "Unable to begin batch" << res;
+    }
+    _batchLevels.append({ .began = res.isEmpty(), .snapshots = {} });
+    return res.isEmpty();
+}
+
+bool Enot::commitBatch()
+{
+    if (_batchLevels.isEmpty())
+    {
+        qWarning() << "There is no batch to commit";
+        return false;
+    }
+
+    auto level = _batchLevels.takeLast();
+
+    // A level that has not begun must not commit, it would close the enclosing transaction
+    QString res;
+    if (level.began)
+        res = Ori::Sql::commitTransaction();
+
+    if (!res.isEmpty())
+    {
+        // Changes of the level have been rolled back, return entries to their previous state
+        restoreEntries(level.snapshots);
+        emit errorOccurred(res);
+    }
+    else if (!_batchLevels.isEmpty())
+    {
+        // Changes of a nested level are rolled back together with the enclosing one,
+        // keep the earliest state of entries to be able to restore it then
+        auto& parentSnapshots = _batchLevels.last().snapshots;
+        for (auto it = level.snapshots.cbegin(); it != level.snapshots.cend(); it++)
+            if (!parentSnapshots.contains(it.key()))
+                parentSnapshots.insert(it.key(), it.value());
+    }
+
+    if (!_batchLevels.isEmpty())
+        return res.isEmpty();
+
+    QList<Entry*> updated;
+    updated.swap(_batchUpdated);
+    _batchUpdatedSet.clear();
+
+    // Entries restored after the outermost rollback have not been changed for views
+    if (!res.isEmpty())
+        updated.removeIf([&level](Entry* entry){ return level.snapshots.contains(entry); });
+
+    if (!updated.isEmpty())
+        emit entriesUpdated(updated);
+
+    return res.isEmpty();
+}
+
+void Enot::rememberEntry(Entry* entry)
+{
+    if (_batchLevels.isEmpty())
+        return;
+    auto& snapshots = _batchLevels.last().snapshots;
+    if (snapshots.contains(entry))
+        return;
+
+    EntrySnapshot snapshot { .title = entry->_title };
+    if (entry->isMemo())
+    {
+        auto memo = entry->asMemo();
+        snapshot.data = memo->_data;
+        snapshot.station = memo->_station;
+        snapshot.isLoaded = memo->_isLoaded;
+        snapshot.updated = memo->_updated;
+        snapshot.props = memo->_props;
+    }
+    snapshots.insert(entry, snapshot);
+}
+
+void Enot::restoreEntries(const QHash<Entry*, EntrySnapshot>& snapshots)
+{
+    for (auto it = snapshots.cbegin(); it != snapshots.cend(); it++)
+    {
+        auto entry = it.key();
+        const auto& snapshot = it.value();
+        entry->_title = snapshot.title;
+        if (!entry->isMemo())
+            continue;
+        auto memo = entry->asMemo();
+        memo->_data = snapshot.data;
+        memo->_station = snapshot.station;
+        memo->_isLoaded = snapshot.isLoaded;
+        memo->_updated = snapshot.updated;
+        memo->_props = snapshot.props;
+        if (memo->_isLoaded)
+            MemoBodyCache::instance()->touch(memo);
+        else
+            MemoBodyCache::instance()->forget(memo);
+    }
+}
+
+void Enot::notifyUpdated(Entry* entry)
+{
+    scheduleCheckpoint();
+
+    if (_batchLevels.isEmpty())
+    {
+        emit entryUpdated(entry);
+        return;
+    }
+    if (!_batchUpdatedSet.contains(entry))
+    {
+        _batchUpdatedSet.insert(entry);
+        _batchUpdated.append(entry);
+    }
+}
+
+void Enot::forgetUpdated(Entry* entry)
+{
+    if (!entry)
+        return;
+    for (auto& level : _batchLevels)
+        level.snapshots.remove(entry);
+    if (_batchUpdatedSet.remove(entry))
+        _batchUpdated.removeOne(entry);
+}
+
+void Enot::scheduleCheckpoint()
+{
+    // Restarting the timer on every change postpones checkpoint until the user stops editing
+    if (_checkpointTimer)
+        _checkpointTimer->start();
+}
+
+void Enot::reindexStale()
+{
+    if (!Store::memos()->hasStaleSearchIndex())
+        return;
+
+    _worker->run<QString>([]{
+        return Store::memos()->reindexStale();
+    }).then(this, [](const QString& res){
+        if (!res.isEmpty())
+            qWarning() << "Unable to update search index" << res;
+    });
+}
+
+QString Enot::rebuildSearchIndex()
+{
+    auto res = Store::memos()->rebuildSearchIndex();
+    if (res.isEmpty())
+        fillSearchIndex();
+    return res;
+}
+
+void Enot::fillSearchIndex()
+{
+    if (!Store::memos()->isSearchIndexed() || Store::memos()->isSearchEnabled())
+        return;
+
+    // Each portion is a separate job and transaction, like for recompression
+    _worker->run<QString>([]{
+        return Store::memos()->fillSearchIndexNext(SEARCH_FILL_BATCH_SIZE);
+    }).then(this, [this](const QString& res){
+        if (!res.isEmpty())
+        {
+            // Memos left in the queue are indexed when the notebook is opened next time
+            qWarning() << "Unable to fill search index" << res;
+            return;
+        }
+        fillSearchIndex();
+    });
+}
+
+void Enot::checkpoint()
+{
+    // Checkpoint can't complete while a transaction is open, wait for the next idle period
+    if (Ori::Sql::transactionDepth() > 0)
+    {
+        scheduleCheckpoint();
+        return;
+    }
+
+    // PASSIVE mode doesn't wait for readers or writers and never blocks the UI
+    Ori::Sql::SelectQuery query("PRAGMA wal_checkpoint(PASSIVE)");
+    if (query.isFailed())
+        qWarning() << "Failed to checkpoint WAL" << query.error();
+}
+
+void Enot::loadNextMemos()
+{
+    if (!_isLoading)
+        return;
+
+    MemosResult res = Store::memos()->selectChunk(_lastLoadedMemoId, _lastMemoIdToLoad, MEMO_CHUNK_SIZE);
+    if (!res.error.isEmpty())
+    {
+        emit errorOccurred(res.error);
+        finishLoading();
+        return;
+    }
+
+    if (!res.warnings.isEmpty())
+        for (const auto &warning: std::as_const(res.warnings))
+            qWarning() << warning; // TODO make protocol window
+
+    bool isLastChunk = res.items.size() < MEMO_CHUNK_SIZE;
+    if (!res.items.isEmpty())
+        _lastLoadedMemoId = res.items.last().memo->id();
+
+    appendMemos(res, true);
+
+    if (isLastChunk)
+        finishLoading();
+    else
+        // Let the event loop process user input between chunks
+        QTimer::singleShot(0, this, &Enot::loadNextMemos);
+}
+
+void Enot::finishLoading()
+{
+    _isLoading = false;
+    _removedFolderIds.clear();
+
+    if (_preloadPropsWhenLoaded)
+        preloadProps();
+
+    emit loadingFinished();
+}
+
+void Enot::appendMemos(const MemosResult& res, bool notify)
+{
+    // Group memos by folder to insert all rows of a folder at once
+    QHash<Folder*, QList<Memo*>> folderMemos;
+
+    for (const auto& item : res.items)
+    {
+        // Should not happen as loading is limited to memos existing before it started,
+        // but a second entry for the same memo would be a duplicate row and a dangling pointer
+        if (_allMemos.contains(item.memo->id()))
+        {
+            qWarning() << "Memo already loaded" << item.memo->id();
+            delete item.memo;
+            continue;
+        }
+
+        auto folder = _allFolders.value(item.folderId);
+        if (!folder)
+        {
+            // The folder has been deleted while loading, its memos are gone from DB too
+            if (_removedFolderIds.contains(item.folderId))
+            {
+                delete item.memo;
+                continue;
+            }
+
+            folder = root();
+            qWarning() << QString("Folder #%1 not found for memo #%2, reparented to the root")
+                              .arg(item.folderId).arg(item.memo->id());
+        }
+
+        item.memo->_parent = folder;
+        item.memo->_station = internStation(item.memo->_station);
+        folderMemos[folder].append(item.memo);
+        _allMemos.insert(item.memo->id(), item.memo);
+    }
+
+    for (auto it = folderMemos.cbegin(); it != folderMemos.cend(); it++)
+    {
+        auto folder = it.key();
+        if (notify)
+            emit memosInserting(folder, folder->_memos.size(), it.value().size());
+        for (auto memo : it.value())
+            appendChild(folder->_memos, memo);
+        if (notify)
+            emit memosInserted(folder);
+    }
+}
+
+QString Enot::internStation(const QString& station)
+{
+    // There are only a few stations, let all memos share the same string data
+    auto it = _stations.constFind(station);
+    if (it != _stations.cend())
+        return *it;
+    _stations.insert(station);
+    return station;
+}
+
 QStringList Enot::propNames()
 {
     if (!_propNames)
@@ -4,7 +4,12 @@
 #include <QObject>
 #include <QList>
 #include <QMap>
+#include <QSet>
 #include <QDateTime>
+#include <QFuture>
+#include <QPromise>
+
+#include <memory>
 
 #include "core/OriResult.h"
 
@@ -12,6 +17,27 @@ class Enot;
 class Folder;
 class Memo;
 class MemoType;
+class StorageWorker;
+struct MemosResult;
+struct RecodeQueue;
+struct RemoveQueue;
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+//------------------------------------------------------------------------------
+
+/// SQLite tuning applied when a notebook is opened.
+struct StorageProfile
+{
+    bool walMode = true;         ///< Use write-ahead log instead of rollback journal.
+    int cacheSizeMb = 16;        ///< Size of page cache.
+    int mmapSizeMb = 256;        ///< Size of memory-mapped I/O region, 0 disables memory mapping.
+    int busyTimeoutMs = 5000;    ///< How long to wait for a lock held by another process.
+    int checkpointIdleMs = 5000; ///< Idle time after the last change before WAL is checkpointed, 0 disables.
+    int memoCacheSizeMb = 256;   ///< Memory budget for texts of loaded memos, 0 means no limit.
+};
 
 //------------------------------------------------------------------------------
 
@@ -31,6 +57,82 @@ struct MemoUpdateParam
 
 //------------------------------------------------------------------------------
 
+/// Dense table of entries indexed by id.
+/// Ids are SQLite rowids which are mostly contiguous, so a plain array
+/// takes much less memory than a map and gives O(1) lookup.
+/// Occasional ids far beyond the table are kept in a hash instead of growing it.
+template <typename TEntry>
+class EntryIndex
+{
+public:
+    TEntry* value(int id) const
+    {
+        if (id >= 0 && id < _items.size())
+            return _items.at(id);
+        return _sparse.value(id);
+    }
+
+    bool contains(int id) const { return value(id); }
+
+    int size() const { return _count; }
+
+    void insert(int id, TEntry* entry)
+    {
+        if (id < 0 || id >= _items.size() * 2 + 1024)
+        {
+            if (!_sparse.contains(id)) _count++;
+            _sparse.insert(id, entry);
+            return;
+        }
+        if (id >= _items.size())
+            grow(qMax(id + 1, _items.size() * 3 / 2));
+        if (!_items.at(id)) _count++;
+        _items[id] = entry;
+    }
+
+    void remove(int id)
+    {
+        if (id >= 0 && id < _items.size())
+        {
+            if (_items.at(id)) _count--;
+            _items[id] = nullptr;
+        }
+        else if (_sparse.remove(id))
+            _count--;
+    }
+
+    template <typename F> void forEach(F f) const
+    {
+        for (auto entry : _items)
+            if (entry) f(entry);
+        for (auto entry : _sparse)
+            f(entry);
+    }
+
+private:
+    // Sparse ids are always beyond the table, lookups rely on it
+    QVector<TEntry*> _items;
+    QHash<int, TEntry*> _sparse;
+    int _count = 0;
+
+    void grow(int size)
+    {
+        _items.resize(size);
+        // Ids that were far beyond the table can get into it now
+        for (auto it = _sparse.begin(); it != _sparse.end(); )
+        {
+            if (it.key() >= 0 && it.key() < size)
+            {
+                _items[it.key()] = it.value();
+                it = _sparse.erase(it);
+            }
+            else it++;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
 class Entry
 {
 public:
@@ -41,6 +143,9 @@ public:
     Folder* parent() const { return _parent; }
     QString path() const;
 
+    /// Index of the entry in the parent's list of memos or folders.
+    int row() const { return _row; }
+
     bool isFolder() const;
     bool isMemo() const;
     Folder* asFolder();
@@ -48,6 +153,7 @@ public:
 
 private:
     int _id;
+    int _row = 0;
     QString _title;
     Folder* _parent = nullptr;
 
@@ -90,9 +196,10 @@ public:
     ~Memo();
 
     MemoType* type() { return _type; }
-    QString data() const { return _data; }
-    QDateTime created() const { return _created; }
-    QDateTime updated() const { return _updated; }
+    /// Text of the memo. It's loaded on demand if the memo is not loaded or has been unloaded from the cache.
+    QString data() const;
+    QDateTime created() const;
+    QDateTime updated() const;
     QString station() const { return _station; }
     bool isLoaded() const { return _isLoaded; }
     const QHash<QString, QString>& props();
@@ -106,11 +213,17 @@ private:
     MemoType* _type = nullptr;
     QString _data, _station;
     bool _isLoaded = false;
-    QDateTime _created, _updated;
+    // Local time as msecs since epoch, as if it were UTC, 0 when unknown.
+    // Much smaller than QDateTime and needs no string parsing when loaded
+    qint64 _created = 0, _updated = 0;
     std::optional<QHash<QString, QString>> _props;
 
+    static QDateTime msecsToTime(qint64 msecs);
+    static qint64 timeToMsecs(const QDateTime& time);
+
     friend class Enot;
     friend class MemoStore;
+    friend class MemoBodyCache;
 };
 
 //------------------------------------------------------------------------------
@@ -127,24 +240,50 @@ class Enot : public QObject
     Q_OBJECT
 
 public:
-    Enot(const QString& fileName);
+    /// Groups several mutations into a single database transaction.
+    /// Updates made inside the batch are reported once via entriesUpdated()
+    /// when the outermost batch is committed.
+    /// When a batch fails to commit, titles, texts and props of changed entries are restored.
+    class Batch
+    {
+    public:
+        explicit Batch(Enot* enot) : _enot(enot) { _enot->beginBatch(); }
+        ~Batch() { _enot->commitBatch(); }
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+    private:
+        Enot* _enot;
+    };
+
+    Enot(const QString& fileName, const StorageProfile& profile = StorageProfile());
     ~Enot();
 
     static QString fileFilter();
     static QString defaultFileExt();
-    static EnotResult open(const QString& fileName);
-    static EnotResult create(const QString& fileName);
+    static EnotResult open(const QString& fileName, bool preloadProps = false,
+                           const StorageProfile& profile = StorageProfile(), bool progressive = false);
+    static EnotResult create(const QString& fileName, const StorageProfile& profile = StorageProfile());
+    static QString applyStorageProfile(const StorageProfile& profile);
 
     QString fileName() const { return _fileName; }
 
     Folder* root() { return &_root; }
 
+    /// Memos are still being loaded when the notebook is opened progressively.
+    bool isLoading() const { return _isLoading; }
+
     Memo* findMemoById(int id) const;
     Folder* findFolderById(int id) const;
 
     QString uid() const;
     QString getOrMakeUid();
 
+    /// Memo texts and sheets are stored compressed, it's a per-notebook option.
+    bool isDataCompressed() const;
+    QFuture<QString> setDataCompressed(bool on);
+
     IntResult countMemos() const;
 
     FolderResult createFolder(Folder* parent, const QString& title);
@@ -156,6 +295,28 @@ public:
     bool deleteMemo(Memo* memo);
     QString loadMemo(Memo* memo);
 
+    // Async versions do I/O in the storage thread and apply results in the GUI thread,
+    // entry signals are emitted from there as usual. They use a separate connection,
+    // so they are not a part of a batch started in the GUI thread.
+    // SQLite allows one writer at a time, so long writes are split into short transactions,
+    // otherwise writes of the GUI thread would wait for them and fail on the busy timeout.
+    QFuture<bool> deleteFolderAsync(Folder* folder);
+    QFuture<bool> updateMemoAsync(Memo* memo, MemoUpdateParam update);
+    QFuture<QString> loadMemoAsync(Memo* memo);
+
+    /// Loads texts of not loaded memos in the storage thread in one query,
+    /// so they are ready when opened. Errors are not reported, memos are loaded as usual then.
+    void prefetchMemos(const QList<Memo*>& memos);
+
+    void preloadProps(Folder* folder = nullptr);
+
+    /// Search index is rebuilt in the storage thread, search is not available until it's done.
+    QString rebuildSearchIndex();
+
+    bool beginBatch();
+    bool commitBatch();
+    bool isBatching() const { return !_batchLevels.isEmpty(); }
+
     QStringList propNames();
     QStringList propValues(const QString& name);
     void addPossiblePropValue(const QString& name, const QString& value);
@@ -164,23 +325,81 @@ signals:
     void entryCreating(Entry*, int);
     void entryCreated(Entry*);
     void entryUpdated(Entry*);
+    void entriesUpdated(const QList<Entry*>&);
     void entryDeleting(Entry*);
     void entryDeleted(Entry*);
+    void memosInserting(Folder* folder, int first, int count);
+    void memosInserted(Folder* folder);
+    void loadingFinished();
     void errorOccurred(const QString& error);
 
 private:
     QString _fileName;
     QString _station;
+    StorageProfile _profile;
+    QTimer* _checkpointTimer = nullptr;
+    QTimer* _reindexTimer = nullptr;
+    StorageWorker* _worker = nullptr;
+    bool _isLoading = false;
+    bool _preloadPropsWhenLoaded = false;
+    int _lastLoadedMemoId = 0;
+    int _lastMemoIdToLoad = 0;
+    QSet<int> _removedFolderIds;
+    QSet<int> _prefetchingIds;
     Folder _root;
-    QMap<int, Memo*> _allMemos;
-    QMap<int, Folder*> _allFolders;
+    EntryIndex<Memo> _allMemos;
+    EntryIndex<Folder> _allFolders;
+    QSet<QString> _stations;
     std::optional<QStringList> _propNames;
     QHash<QString, QStringList> _propValues;
+    // Fields of entries as they were before the first change in a batch level,
+    // they are restored when the level's transaction is rolled back
+    struct EntrySnapshot
+    {
+        QString title;
+        QString data, station;
+        bool isLoaded = false;
+        qint64 updated = 0;
+        std::optional<QHash<QString, QString>> props;
+    };
+    struct BatchLevel
+    {
+        // False when the level's transaction could not be begun,
+        // then its changes are written by the enclosing one or autocommitted
+        bool began;
+        QHash<Entry*, EntrySnapshot> snapshots;
+    };
+    QList<BatchLevel> _batchLevels;
+    QList<Entry*> _batchUpdated;
+    QSet<Entry*> _batchUpdatedSet;
 
-    static QString prepareStore(const QString fileName);
+    static QString prepareStore(const QString fileName, const StorageProfile& profile);
 
     void fillFolderIdsFlat(Folder* root, QVector<int>& ids);
     void fillMemoIdsFlat(Folder* root, QVector<int>& ids);
+    void removeFolderEntries(Folder* folder);
+    void removeMemoEntry(Memo* memo);
+    void removeBranchNext(int folderId, std::shared_ptr<RemoveQueue> queue, std::shared_ptr<QPromise<bool>> promise);
+    QFuture<bool> removeBranchFolders(int folderId);
+    void appendMemos(const MemosResult& res, bool notify);
+
+    // Keep cached rows of entries in sync with their parent's lists
+    template <typename TEntry> static void appendChild(QList<TEntry*>& children, TEntry* entry);
+    template <typename TEntry> static void removeChild(QList<TEntry*>& children, TEntry* entry);
+    QString internStation(const QString& station);
+    void loadNextMemos();
+    void finishLoading();
+    void applyMemoUpdate(Memo* memo, const MemoUpdateParam& update);
+    static QString writeMemo(int memoId, const MemoUpdateParam& update, const QHash<QString, QString>& oldProps);
+    void rememberEntry(Entry* entry);
+    void restoreEntries(const QHash<Entry*, EntrySnapshot>& snapshots);
+    void notifyUpdated(Entry* entry);
+    void forgetUpdated(Entry* entry);
+    void scheduleCheckpoint();
+    void reindexStale();
+    void fillSearchIndex();
+    void recodeNext(std::shared_ptr<RecodeQueue> queue, std::shared_ptr<QPromise<QString>> promise);
+    void checkpoint();
 };
 
 #endif // ENOT_H
@@ -31,12 +31,19 @@ public:
                "Parent, Title)";
     }
 
+    // Id is an alias of ROWID, it's assigned by SQLite
     const QString sqlInsert =
-        "INSERT INTO Folder (Id, Parent, Title) "
-        "VALUES (:Id, :Parent, :Title)";
+        "INSERT INTO Folder (Parent, Title) "
+        "VALUES (:Parent, :Title)";
 
     const QString sqlRename = "UPDATE Folder SET Title = :Title WHERE Id = :Id";
     const QString sqlDelete = "DELETE FROM Folder WHERE Id = :Id";
+
+    const QString sqlSelectBranch =
+        "WITH RECURSIVE Branch(Id) AS ("
+        "SELECT :Id UNION ALL "
+        "SELECT Folder.Id FROM Folder JOIN Branch ON Folder.Parent = Branch.Id) "
+        "SELECT Id FROM Branch";
 };
 
 FolderTableDef* folderTable() { static FolderTableDef t; return &t; }
@@ -56,20 +63,19 @@ QString FolderStore::create(Folder* folder) const
 {
     auto table = folderTable();
 
-    SelectQuery queryId(table->sqlSelectMaxId());
-    if (queryId.isFailed() || !queryId.next())
-        return qApp->tr("Unable to generate id for new folder.\n\n%1").arg(queryId.error());
-
-    folder->_id = queryId.record().value(0).toInt() + 1;
-
-    auto res = ActionQuery(table->sqlInsert)
-                .param(table->id, folder->id())
+    ActionQuery query(table->sqlInsert);
+    auto res = query
                 .param(table->parent, folder->parent()->id())
                 .param(table->title, folder->title())
                 .exec();
     if (!res.isEmpty())
         return qApp->tr("Failed to create new folder.\n\n%1").arg(res);
 
+    bool ok;
+    folder->_id = query.lastInsertId().toInt(&ok);
+    if (!ok)
+        return qApp->tr("Unable to get id of new folder.");
+
     return QString();
 }
 
@@ -110,21 +116,84 @@ QString FolderStore::rename(int folderId, const QString title) const
 
 QString FolderStore::remove(Folder *folder) const
 {
-    auto db = QSqlDatabase::database();
-    bool ok = db.transaction();
-    if (!ok)
+    QString res = beginTransaction();
+    if (!res.isEmpty())
         return QString("Unable to start transaction for removing folder #%1.\n\n%2")
-                .arg(folder->id()).arg(SqlHelper::errorText(db.lastError()));
+                .arg(folder->id()).arg(res);
 
-    QString res = removeBranch(folder, QString());
+    res = removeBranch(folder, QString());
     if (!res.isEmpty())
     {
-        db.rollback();
+        rollbackTransaction();
         return res;
     }
 
-    db.commit();
-    return QString();
+    return commitTransaction();
+}
+
+QString FolderStore::remove(const QVector<int>& folderIds) const
+{
+    auto table = folderTable();
+
+    QString res = beginTransaction();
+    if (!res.isEmpty())
+        return QString("Unable to start transaction for removing folders.\n\n%1").arg(res);
+
+    for (auto id : folderIds)
+    {
+        res = ActionQuery(table->sqlDelete)
+                .param(table->id, id)
+                .exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return QString("Failed to delete folder #%1.\n\n%2").arg(id).arg(res);
+        }
+    }
+
+    // Memos are DB deleted by FK relation
+
+    return commitTransaction();
+}
+
+QString FolderStore::removeBranch(int folderId, QVector<int>* removedIds) const
+{
+    auto table = folderTable();
+
+    QString res = beginTransaction();
+    if (!res.isEmpty())
+        return QString("Unable to start transaction for removing folder #%1.\n\n%2").arg(folderId).arg(res);
+
+    // Subfolders are taken from DB in the same transaction,
+    // so the ones created after the removal was requested are removed too
+    auto q = AnyQuery(table->sqlSelectBranch).param(table->id, folderId).exec();
+    if (q.isFailed())
+    {
+        rollbackTransaction();
+        return QString("Failed to get subfolders of folder #%1.\n\n%2").arg(folderId).arg(q.error());
+    }
+    QVector<int> ids;
+    while (q.next())
+        ids << q.record().value(0).toInt();
+
+    for (auto id : std::as_const(ids))
+    {
+        res = ActionQuery(table->sqlDelete)
+                .param(table->id, id)
+                .exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return QString("Failed to delete folder #%1.\n\n%2").arg(id).arg(res);
+        }
+    }
+
+    // Memos are DB deleted by FK relation
+
+    res = commitTransaction();
+    if (res.isEmpty())
+        *removedIds = ids;
+    return res;
 }
 
 QString FolderStore::removeBranch(Folder* folder, const QString& path) const
@@ -22,6 +22,9 @@ public:
     QString create(Folder* folder) const;
     QString rename(int folderId, const QString title) const;
     QString remove(Folder* folder) const;
+    QString remove(const QVector<int>& folderIds) const;
+    /// Removes the folder and all its subfolders as they are in DB at the moment.
+    QString removeBranch(int folderId, QVector<int>* removedIds) const;
     FoldersResult selectAll() const;
 
 private:
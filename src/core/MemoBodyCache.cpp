@@ -0,0 +1,117 @@
+#include "MemoBodyCache.h"
+
+#include "Enot.h"
+
+//------------------------------------------------------------------------------
+//                             MemoBodyCache::Pin
+//------------------------------------------------------------------------------
+
+MemoBodyCache::Pin::Pin(Memo* memo) : _memo(memo)
+{
+    auto cache = MemoBodyCache::instance();
+    _generation = cache->_generation;
+    cache->_pins[_memo]++;
+}
+
+MemoBodyCache::Pin::~Pin()
+{
+    auto cache = MemoBodyCache::instance();
+    if (_generation != cache->_generation)
+        return;
+
+    auto it = cache->_pins.find(_memo);
+    if (it == cache->_pins.end())
+        return;
+    if (--it.value() <= 0)
+    {
+        cache->_pins.erase(it);
+        // Text of the closed memo can be over budget now
+        cache->evict();
+    }
+}
+
+//------------------------------------------------------------------------------
+//                               MemoBodyCache
+//------------------------------------------------------------------------------
+
+MemoBodyCache* MemoBodyCache::instance()
+{
+    static MemoBodyCache cache;
+    return &cache;
+}
+
+void MemoBodyCache::setBudget(qint64 bytes)
+{
+    _budget = bytes;
+    evict();
+}
+
+void MemoBodyCache::touch(Memo* memo)
+{
+    const qint64 size = memo->_data.size() * qint64(sizeof(QChar));
+
+    auto it = _nodes.find(memo);
+    if (it == _nodes.end())
+    {
+        _order.push_front(memo);
+        _nodes.insert(memo, Node { .pos = _order.begin(), .size = size });
+        _size += size;
+    }
+    else
+    {
+        _order.splice(_order.begin(), _order, it->pos);
+        _size += size - it->size;
+        it->size = size;
+    }
+
+    evict();
+}
+
+void MemoBodyCache::forget(Memo* memo)
+{
+    auto it = _nodes.find(memo);
+    if (it == _nodes.end())
+        return;
+    _size -= it->size;
+    _order.erase(it->pos);
+    _nodes.erase(it);
+}
+
+void MemoBodyCache::clear()
+{
+    _order.clear();
+    _nodes.clear();
+    _pins.clear();
+    _size = 0;
+    _evictions = 0;
+    _generation++;
+}
+
+void MemoBodyCache::evict()
+{
+    if (_budget <= 0)
+        return;
+
+    auto it = _order.end();
+    while (_size > _budget && it != _order.begin())
+    {
+        --it;
+
+        // The most recently used memo is just requested, it's kept even when larger than the budget
+        if (it == _order.begin())
+            break;
+
+        auto memo = *it;
+        if (_pins.contains(memo))
+            continue;
+
+        auto node = _nodes.find(memo);
+        _size -= node->size;
+        _nodes.erase(node);
+        it = _order.erase(it);
+
+        memo->_data = QString();
+        memo->_isLoaded = false;
+        _evictions++;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef MEMO_BODY_CACHE_H
+#define MEMO_BODY_CACHE_H
+
+#include <QHash>
+
+#include <list>
+
+class Memo;
+
+/// Keeps loaded memo texts within a memory budget.
+/// Texts of least recently used memos are dropped when the budget is exceeded,
+/// such memos are loaded again when their data is requested.
+/// Memos opened in tabs are pinned and never dropped.
+/// The cache is only used in the GUI thread.
+class MemoBodyCache
+{
+public:
+    /// Keeps a memo in the cache for the lifetime of the object.
+    class Pin
+    {
+    public:
+        explicit Pin(Memo* memo);
+        ~Pin();
+
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+
+    private:
+        Memo* _memo;
+        int _generation;
+    };
+
+    static MemoBodyCache* instance();
+
+    qint64 budget() const { return _budget; }
+    void setBudget(qint64 bytes);
+
+    qint64 size() const { return _size; }
+    int count() const { return _nodes.size(); }
+    int evictions() const { return _evictions; }
+
+    /// Marks the memo as the most recently used and updates its size.
+    void touch(Memo* memo);
+
+    /// Removes the memo from the cache without dropping its text.
+    void forget(Memo* memo);
+
+    /// Forgets all memos and pins, it's done when a notebook is closed.
+    void clear();
+
+private:
+    MemoBodyCache() {}
+
+    struct Node
+    {
+        std::list<Memo*>::iterator pos;
+        qint64 size;
+    };
+
+    std::list<Memo*> _order; // the most recently used is the first
+    QHash<Memo*, Node> _nodes;
+    QHash<Memo*, int> _pins;
+    qint64 _budget = 0;
+    qint64 _size = 0;
+    int _evictions = 0;
+    // Pins made before a notebook was closed don't affect memos of the next one
+    int _generation = 0;
+
+    void evict();
+};
+
+#endif // MEMO_BODY_CACHE_H
@@ -4,6 +4,11 @@
 #include "MemoType.h"
 #include "SqlHelper.h"
 
+#include <QCryptographicHash>
+#include <QDebug>
+
+#include <array>
+
 using namespace Ori::Sql;
 using namespace Qt::StringLiterals;
 
@@ -31,6 +36,7 @@ public:
     const QString created = "Created";
     const QString updated = "Updated";
     const QString station = "Station";
+    const QString chunks = "Chunks";
 
     QString sqlCreate() const override {
         return u"CREATE TABLE IF NOT EXISTS Memo ("
@@ -42,22 +48,68 @@ public:
                "Created DATETIME DEFAULT CURRENT_TIMESTAMP, "
                "Updated DATETIME DEFAULT CURRENT_TIMESTAMP, "
                "Station TEXT,"
+               "Chunks TEXT,"
                "FOREIGN KEY (Parent) REFERENCES Folder(Id) ON DELETE CASCADE"
                ")"_s;
     }
 
+    // Timestamps are converted to msecs since epoch by SQLite,
+    // it's much faster than parsing strings into QDateTime for every memo.
+    // Stored values have no time zone, they are local times taken as if they were UTC
     inline static const auto& sqlSelectAllNoData =
-        u"SELECT Id, Parent, Title, Type, Created, Updated, Station FROM Memo"_s;
+        u"SELECT Id, Parent, Title, Type, "
+        "CAST(ROUND((julianday(Created) - 2440587.5) * 86400000) AS INTEGER) AS Created, "
+        "CAST(ROUND((julianday(Updated) - 2440587.5) * 86400000) AS INTEGER) AS Updated, "
+        "Station FROM Memo"_s;
 
-    virtual QString sqlSelectDataById(int id) const {
-        return QString("SELECT Data FROM Memo WHERE Id = %1").arg(id);
-    }
+    inline static const auto& sqlSelectChunkNoData =
+        u"SELECT Id, Parent, Title, Type, "
+        "CAST(ROUND((julianday(Created) - 2440587.5) * 86400000) AS INTEGER) AS Created, "
+        "CAST(ROUND((julianday(Updated) - 2440587.5) * 86400000) AS INTEGER) AS Updated, "
+        "Station FROM Memo "
+        "WHERE Id > :AfterId AND Id <= :LastId ORDER BY Id LIMIT :Limit"_s;
+
+    inline static const auto& sqlSelectMaxId =
+        u"SELECT MAX(Id) FROM Memo"_s;
+
+    // Large memos have Data empty and keep their text in MemoChunks,
+    // then Chunks is a list of hashes of the memo's chunks in order of the text
+    inline static const auto& sqlSelectData =
+        u"SELECT Data, Chunks FROM Memo WHERE Id = :Id"_s;
+
+    // Ids are passed as a JSON array, then the statement is the same for any number of ids
+    inline static const auto& sqlSelectDataMany =
+        u"SELECT Id, Data, Chunks FROM Memo WHERE Id IN (SELECT value FROM json_each(:Ids))"_s;
+
+    inline static const auto& sqlSelectChunks =
+        u"SELECT Chunks FROM Memo WHERE Id = :Id"_s;
+
+    inline static const auto& sqlSelectTitle =
+        u"SELECT Title, Chunks FROM Memo WHERE Id = :Id"_s;
 
+    inline static const auto& sqlUpdateData =
+        u"UPDATE Memo SET Data = :Data, Chunks = :Chunks WHERE Id = :Id"_s;
+
+    // Texts shorter than MinSize are never compressed, don't take them again on every run
+    inline static const auto& sqlSelectRecodable =
+        u"SELECT Id FROM Memo WHERE Chunks IS NULL AND Data IS NOT NULL AND (typeof(Data) = 'blob') != :Compress "
+        "AND (:Compress = 0 OR length(CAST(Data AS BLOB)) >= :MinSize)"_s;
+
+    inline static const auto& sqlUpdateDataOnly =
+        u"UPDATE Memo SET Data = :Data WHERE Id = :Id"_s;
+
+    // Id is an alias of ROWID, it's assigned by SQLite
     inline static const auto& sqlInsert =
-        u"INSERT INTO Memo (Id, Parent, Title, Type, Data, Created, Updated, Station) "
-        "VALUES (:Id, :Parent, :Title, :Type, :Data, :Created, :Updated, :Station)"_s;
+        u"INSERT INTO Memo (Parent, Title, Type, Data, Created, Updated, Station) "
+        "VALUES (:Parent, :Title, :Type, :Data, :Created, :Updated, :Station)"_s;
 
     inline static const auto& sqlDelete = u"DELETE FROM Memo WHERE Id = :Id"_s;
+
+    inline static const auto& sqlSelectBranch =
+        u"WITH RECURSIVE Branch(Id) AS ("
+        "SELECT :Id UNION ALL "
+        "SELECT Folder.Id FROM Folder JOIN Branch ON Folder.Parent = Branch.Id) "
+        "SELECT Memo.Id FROM Memo JOIN Branch ON Memo.Parent = Branch.Id"_s;
 };
 
 struct MemoOptionsTable
@@ -96,6 +148,7 @@ struct MemoPropsTable
         inline static const auto& memoId = u"MemoId"_s;
         inline static const auto& name = u"Name"_s;
         inline static const auto& value = u"Value"_s;
+        inline static const auto& folderId = u"FolderId"_s;
     };
 
     inline static const auto& sqlCreate =
@@ -109,6 +162,13 @@ struct MemoPropsTable
     inline static const auto& sqlSelect =
         u"SELECT Name, Value from MemoProps WHERE MemoId = :MemoId"_s;
 
+    inline static const auto& sqlSelectAll =
+        u"SELECT MemoId, Name, Value from MemoProps"_s;
+
+    inline static const auto& sqlSelectByFolder =
+        u"SELECT p.MemoId, p.Name, p.Value from MemoProps p "
+        "JOIN Memo m ON m.Id = p.MemoId WHERE m.Parent = :FolderId"_s;
+
     inline static const auto& sqlUpdate =
         u"INSERT INTO MemoProps (MemoId, Name, Value) VALUES (:MemoId, :Name, :Value) "
         "ON CONFLICT (MemoId, Name) DO UPDATE SET Value = :Value"_s;
@@ -166,8 +226,15 @@ struct MemoSheetsTable
 
     struct C
     {
+        inline static const auto& id = u"Id"_s;
         inline static const auto& memoId = u"MemoId"_s;
         inline static const auto& data = u"Data"_s;
+        inline static const auto& created = u"Created"_s;
+        inline static const auto& updated = u"Updated"_s;
+        inline static const auto& station = u"Station"_s;
+        inline static const auto& offset = u"Offset"_s;
+        inline static const auto& limit = u"Limit"_s;
+        inline static const auto& compress = u"Compress"_s;
     };
 
     inline static const auto& sqlCreate =
@@ -180,12 +247,262 @@ struct MemoSheetsTable
         "Station TEXT, "
         "FOREIGN KEY (MemoId) REFERENCES Memo(Id) ON DELETE CASCADE)"_s;
 
+    inline static const auto& sqlCount =
+        u"SELECT COUNT(*) FROM MemoSheets WHERE MemoId = :MemoId"_s;
+
+    // Pages are read from the (MemoId, Created) index without sorting all sheets of the memo,
+    // ordering columns are qualified to not be confused with the converted ones
+    inline static const auto& sqlSelectPage =
+        u"SELECT Id, Data, Station, "
+        "CAST(ROUND((julianday(Created) - 2440587.5) * 86400000) AS INTEGER) AS Created, "
+        "CAST(ROUND((julianday(Updated) - 2440587.5) * 86400000) AS INTEGER) AS Updated "
+        "FROM MemoSheets WHERE MemoId = :MemoId "
+        "ORDER BY MemoSheets.Created DESC, MemoSheets.Id DESC LIMIT :Limit OFFSET :Offset"_s;
+
+    // Compressed texts are BLOBs, plain ones are TEXT.
+    // Texts shorter than MinSize are never compressed, don't take them again on every run
+    inline static const auto& sqlSelectRecodable =
+        u"SELECT Id FROM MemoSheets WHERE Data IS NOT NULL AND (typeof(Data) = 'blob') != :Compress "
+        "AND (:Compress = 0 OR length(CAST(Data AS BLOB)) >= :MinSize)"_s;
+
+    inline static const auto& sqlSelectById =
+        u"SELECT Data FROM MemoSheets WHERE Id = :Id"_s;
+
+    inline static const auto& sqlUpdateData =
+        u"UPDATE MemoSheets SET Data = :Data WHERE Id = :Id"_s;
+};
+
+struct MemoChunksTable
+{
+    inline static const auto& tableName = u"MemoChunks"_s;
+
+    struct C
+    {
+        inline static const auto& memoId = u"MemoId"_s;
+        inline static const auto& hash = u"Hash"_s;
+        inline static const auto& data = u"Data"_s;
+        inline static const auto& compress = u"Compress"_s;
+    };
+
+    // Chunks are UTF-8 bytes of the text. Equal chunks of a memo are stored once
+    inline static const auto& sqlCreate =
+        u"CREATE TABLE IF NOT EXISTS MemoChunks ("
+        "MemoId INTEGER NOT NULL, "
+        "Hash TEXT NOT NULL, "
+        "Data BLOB, "
+        "PRIMARY KEY (MemoId, Hash), "
+        "FOREIGN KEY (MemoId) REFERENCES Memo(Id) ON DELETE CASCADE)"_s;
+
     inline static const auto& sqlSelect =
-        u"SELECT Data FROM MemoSheets WHERE MemoId = :MemoId"_s;
+        u"SELECT Hash, Data FROM MemoChunks WHERE MemoId = :MemoId"_s;
+
+    inline static const auto& sqlInsert =
+        u"INSERT OR IGNORE INTO MemoChunks (MemoId, Hash, Data) VALUES (:MemoId, :Hash, :Data)"_s;
+
+    inline static const auto& sqlDelete =
+        u"DELETE FROM MemoChunks WHERE MemoId = :MemoId AND Hash = :Hash"_s;
+
+    inline static const auto& sqlDeleteAll =
+        u"DELETE FROM MemoChunks WHERE MemoId = :MemoId"_s;
+
+    // Chunks are always BLOBs, compressed ones start with the prefix, see COMPRESSED_PREFIX
+    inline static const auto& sqlSelectRecodable =
+        u"SELECT MemoId, Hash FROM MemoChunks WHERE (substr(Data, 1, 4) = X'00505A43') != :Compress "
+        "AND (:Compress = 0 OR length(Data) >= :MinSize)"_s;
+
+    inline static const auto& sqlSelectOne =
+        u"SELECT Data FROM MemoChunks WHERE MemoId = :MemoId AND Hash = :Hash"_s;
+
+    inline static const auto& sqlUpdate =
+        u"UPDATE MemoChunks SET Data = :Data WHERE MemoId = :MemoId AND Hash = :Hash"_s;
+};
+
+struct MemoSearchTable
+{
+    inline static const auto& tableName = u"MemoSearch"_s;
+
+    struct C
+    {
+        inline static const auto& id = u"Id"_s;
+        inline static const auto& title = u"Title"_s;
+        inline static const auto& data = u"Data"_s;
+        inline static const auto& query = u"Query"_s;
+        inline static const auto& limit = u"Limit"_s;
+    };
+
+    // Contentless FTS5 table, it keeps only the index and not a copy of texts,
+    // which would be bigger than compressed texts themselves. Rows can't be updated partially,
+    // they are replaced with the whole title and text. Rowid of the table is memo id.
+    // Deleting from contentless tables needs SQLite 3.43, search is not available with older ones.
+    inline static const auto& sqlCreate =
+        u"CREATE VIRTUAL TABLE MemoSearch USING fts5(Title, Data, content = '', contentless_delete = 1, "
+        "tokenize = 'unicode61 remove_diacritics 2')"_s;
+
+    inline static const auto& sqlCheck =
+        u"SELECT sql FROM sqlite_master WHERE type = 'table' AND name = 'MemoSearch'"_s;
+
+    // The index was a regular table having a copy of texts before
+    inline static const auto& sqlDrop =
+        u"DROP TABLE MemoSearch"_s;
+
+    inline static const auto& sqlCheckTrigger =
+        u"SELECT name FROM sqlite_master WHERE type = 'trigger' AND name = 'MemoSearchDelete'"_s;
+
+    // Fails when SQLite has no FTS5, though the table exists in the schema
+    inline static const auto& sqlProbe =
+        u"SELECT rowid FROM MemoSearch LIMIT 0"_s;
+
+    inline static const auto& sqlDropDeleteTrigger =
+        u"DROP TRIGGER IF EXISTS MemoSearchDelete"_s;
+
+    // Memos are deleted from many places including FK relation when a folder is deleted
+    inline static const auto& sqlCreateDeleteTrigger =
+        u"CREATE TRIGGER IF NOT EXISTS MemoSearchDelete AFTER DELETE ON Memo "
+        "BEGIN DELETE FROM MemoSearch WHERE rowid = old.Id; END"_s;
+
+    inline static const auto& sqlClear =
+        u"INSERT INTO MemoSearch (MemoSearch) VALUES ('delete-all')"_s;
+
+    // Memos not indexed yet. The index is filled from the queue by portions in the storage thread,
+    // the queue is in DB, so filling is continued when the notebook is opened next time
+    inline static const auto& sqlCreateQueue =
+        u"CREATE TABLE IF NOT EXISTS MemoSearchQueue (Id INTEGER PRIMARY KEY)"_s;
+
+    inline static const auto& sqlQueueAll =
+        u"INSERT OR IGNORE INTO MemoSearchQueue (Id) SELECT Id FROM Memo"_s;
+
+    inline static const auto& sqlCheckQueue =
+        u"SELECT Id FROM MemoSearchQueue LIMIT 1"_s;
+
+    // Memos deleted after they were queued have no Memo row
+    inline static const auto& sqlSelectQueued =
+        u"SELECT q.Id, m.Id AS MemoId, m.Title, m.Data, m.Chunks FROM MemoSearchQueue q "
+        "LEFT JOIN Memo m ON m.Id = q.Id ORDER BY q.Id LIMIT :Limit"_s;
+
+    inline static const auto& sqlDequeue =
+        u"DELETE FROM MemoSearchQueue WHERE Id <= :Id"_s;
+
+    // Memos created while filling are indexed when created, the queue can have their ids
+    // if they reuse ids of deleted memos, then the row is replaced
+    inline static const auto& sqlReplace =
+        u"INSERT OR REPLACE INTO MemoSearch (rowid, Title, Data) VALUES (:Id, :Title, :Data)"_s;
+
+    inline static const auto& sqlInsert =
+        u"INSERT INTO MemoSearch (rowid, Title, Data) VALUES (:Id, :Title, :Data)"_s;
+
+    // Matches in titles weigh more than in texts.
+    // There is no snippet() for a contentless table, snippets are made from loaded texts
+    inline static const auto& sqlSearch =
+        u"SELECT rowid AS Id FROM MemoSearch WHERE MemoSearch MATCH :Query "
+        "ORDER BY bm25(MemoSearch, 10.0, 1.0) LIMIT :Limit"_s;
 };
 
 MemoTableDef* memoTable() { static MemoTableDef t; return &t; }
 
+// Total size of texts indexed in one transaction when the search index is filled
+const qsizetype SEARCH_FILL_MAX_SIZE = 16 * 1024 * 1024;
+
+//------------------------------------------------------------------------------
+//                               Chunking
+//------------------------------------------------------------------------------
+
+// Memos of this size are stored in chunks, smaller ones are in the Data column
+const int CHUNKED_DATA_MIN_SIZE = 256 * 1024;
+
+const qsizetype CHUNK_MIN_SIZE = 16 * 1024;
+const qsizetype CHUNK_MAX_SIZE = 256 * 1024;
+// 16 bits of the mask give 64K average chunk
+const quint64 CHUNK_BOUNDARY_MASK = 0xFFFF000000000000ull;
+
+// The table must not change between versions,
+// otherwise chunk boundaries of existing memos move and everything is rewritten
+std::array<quint64, 256> makeGearTable()
+{
+    std::array<quint64, 256> table;
+    quint64 x = 0x9E3779B97F4A7C15ull;
+    for (auto& v : table)
+    {
+        // splitmix64
+        quint64 z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        v = z ^ (z >> 31);
+    }
+    return table;
+}
+
+/// Content-defined chunking with a gear rolling hash.
+/// Boundaries depend on content, not on offsets, so an edit changes only
+/// the chunk where it is made, the rest of the text gives the same chunks.
+QList<QByteArrayView> splitIntoChunks(const QByteArray& data)
+{
+    static const auto gear = makeGearTable();
+
+    QList<QByteArrayView> chunks;
+    const qsizetype size = data.size();
+    const auto bytes = reinterpret_cast<const uchar*>(data.constData());
+    qsizetype start = 0;
+    while (start < size)
+    {
+        qsizetype end = qMin(start + CHUNK_MAX_SIZE, size);
+        qsizetype cut = end;
+        quint64 h = 0;
+        for (qsizetype pos = start + CHUNK_MIN_SIZE; pos < end; pos++)
+        {
+            h = (h << 1) + gear[bytes[pos]];
+            if ((h & CHUNK_BOUNDARY_MASK) == 0)
+            {
+                cut = pos + 1;
+                break;
+            }
+        }
+        chunks << QByteArrayView(data.constData() + start, cut - start);
+        start = cut;
+    }
+    return chunks;
+}
+
+QString chunkHash(QByteArrayView chunk)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(chunk, QCryptographicHash::Sha1).toHex());
+}
+
+//------------------------------------------------------------------------------
+//                              Compression
+//------------------------------------------------------------------------------
+
+// Compressed texts are stored as BLOBs starting with the prefix.
+// Text can't start with NUL, so a plain chunk is never taken for a compressed one
+const QByteArray COMPRESSED_PREFIX("\0PZC", 4);
+
+// Short texts can get even longer after compression
+const int COMPRESS_MIN_SIZE = 256;
+
+/// Returns compressed bytes with the prefix, or empty array when compression doesn't make them shorter.
+QByteArray compressBytes(QByteArrayView bytes)
+{
+    if (bytes.size() < COMPRESS_MIN_SIZE)
+        return {};
+    QByteArray compressed = COMPRESSED_PREFIX + qCompress(reinterpret_cast<const uchar*>(bytes.data()), bytes.size());
+    if (compressed.size() >= bytes.size())
+        return {};
+    return compressed;
+}
+
+QByteArray decodeBytes(const QByteArray& bytes)
+{
+    if (bytes.startsWith(COMPRESSED_PREFIX))
+        return qUncompress(bytes.mid(COMPRESSED_PREFIX.size()));
+    return bytes;
+}
+
+QString decodeText(const QVariant& value)
+{
+    if (value.typeId() == QMetaType::QByteArray)
+        return QString::fromUtf8(decodeBytes(value.toByteArray()));
+    return value.toString();
+}
+
 } // namespace
 
 //------------------------------------------------------------------------------
@@ -208,6 +525,9 @@ QString MemoStore::prepare()
     res = maybeAddColumn(table->tableName(), table->station);
     if (!res.isEmpty()) return res;
 
+    res = maybeAddColumn(table->tableName(), table->chunks);
+    if (!res.isEmpty()) return res;
+
     res = maybeAddIndex(table->tableName(), table->parent);
 
     {
@@ -220,8 +540,16 @@ QString MemoStore::prepare()
         if (!res.isEmpty()) return res;
     }
 
-    res = createTable<MemoPropsTable>();
-    if (!res.isEmpty()) return res;
+    {
+        using T = MemoPropsTable;
+
+        res = createTable<T>();
+        if (!res.isEmpty()) return res;
+
+        // For lists of prop names and values of a given prop, used in filters
+        res = maybeAddIndex(T::tableName, {T::C::name, T::C::value});
+        if (!res.isEmpty()) return res;
+    }
     
     {
         using T = MemoLinksTable;
@@ -236,36 +564,183 @@ QString MemoStore::prepare()
     res = createTable<MemoHistoryTable>();
     if (!res.isEmpty()) return res;
 
-    res = createTable<MemoSheetsTable>();
+    {
+        using T = MemoSheetsTable;
+
+        res = createTable<T>();
+        if (!res.isEmpty()) return res;
+
+        // For loading sheets of a memo page by page, the newest first
+        res = maybeAddIndex(T::tableName, {T::C::memoId, T::C::created});
+        if (!res.isEmpty()) return res;
+    }
+
+    res = createTable<MemoChunksTable>();
     if (!res.isEmpty()) return res;
 
+    prepareSearch();
+
     return {};
 }
 
+void MemoStore::prepareSearch()
+{
+    using T = MemoSearchTable;
+
+    _isSearchIndexed = false;
+    _isSearchEnabled = false;
+
+    auto check = [](const QString& sql, bool& exists){
+        SelectQuery query(sql);
+        if (query.isFailed())
+        {
+            qWarning() << "Unable to check search index" << query.error();
+            return false;
+        }
+        exists = query.next();
+        return true;
+    };
+    bool triggerExists;
+    if (!check(T::sqlCheckTrigger, triggerExists))
+        return;
+
+    QString tableSql;
+    {
+        SelectQuery query(T::sqlCheck);
+        if (query.isFailed())
+        {
+            qWarning() << "Unable to check search index" << query.error();
+            return;
+        }
+        if (query.next())
+            tableSql = query.record().value(0).toString();
+    }
+    bool exists = !tableSql.isEmpty();
+    // SQLite keeps the statement as it was given, see MemoSearchTable::sqlCreate
+    bool isContentless = tableSql.contains(u"content = ''"_s);
+
+    if (exists)
+    {
+        SelectQuery probe(T::sqlProbe);
+        if (probe.isFailed())
+        {
+            // The notebook is opened with SQLite built without FTS5, the app still works then,
+            // only without search. The trigger would fail deleting of memos, so it's dropped,
+            // and its absence tells that the index must be rebuilt when FTS5 is available again
+            qWarning() << "Full-text search is not available" << probe.error();
+            auto res = ActionQuery(T::sqlDropDeleteTrigger).exec();
+            if (!res.isEmpty())
+                qWarning() << "Unable to drop search index trigger" << res;
+            return;
+        }
+    }
+
+    // Only the structure is made here, in a savepoint, so it's never left half-made.
+    // Memos are queued for indexing, and the index is filled later in the storage thread,
+    // see fillSearchIndexNext(). Don't use createTable() here, it rollbacks the whole preparation on failure
+    auto res = ActionQuery(u"SAVEPOINT prepare_search"_s).exec();
+    if (!res.isEmpty())
+    {
+        qWarning() << "Unable to prepare search index" << res;
+        return;
+    }
+
+    if (exists && !isContentless)
+    {
+        // Drop the index having a copy of texts, it's made again as contentless one
+        res = ActionQuery(T::sqlDrop).exec();
+        exists = false;
+    }
+    if (res.isEmpty() && !exists)
+        res = ActionQuery(T::sqlCreate).exec();
+    else if (res.isEmpty() && !triggerExists)
+        // Memos have been changed while search was not available
+        res = ActionQuery(T::sqlClear).exec();
+    if (res.isEmpty())
+        res = ActionQuery(T::sqlCreateQueue).exec();
+    if (res.isEmpty() && (!exists || !triggerExists))
+        res = ActionQuery(T::sqlQueueAll).exec();
+    if (res.isEmpty())
+        res = ActionQuery(T::sqlCreateDeleteTrigger).exec();
+
+    if (!res.isEmpty())
+    {
+        qWarning() << "Unable to prepare search index" << res;
+        auto rollbackRes = ActionQuery(u"ROLLBACK TO SAVEPOINT prepare_search"_s).exec();
+        if (rollbackRes.isEmpty())
+            rollbackRes = ActionQuery(u"RELEASE SAVEPOINT prepare_search"_s).exec();
+        if (!rollbackRes.isEmpty())
+            qWarning() << "Failed to rollback search index preparation" << rollbackRes;
+        return;
+    }
+
+    res = ActionQuery(u"RELEASE SAVEPOINT prepare_search"_s).exec();
+    if (!res.isEmpty())
+    {
+        qWarning() << "Unable to prepare search index" << res;
+        return;
+    }
+
+    // The index is kept up to date from now on, but it's not searched until filled
+    _isSearchIndexed = true;
+
+    bool isQueued;
+    if (check(T::sqlCheckQueue, isQueued))
+        _isSearchEnabled = !isQueued;
+}
+
 QString MemoStore::create(Memo* memo) const
 {
     auto table = memoTable();
 
-    SelectQuery queryId(table->sqlSelectMaxId());
-    if (queryId.isFailed() || !queryId.next())
-        return QString("Unable to generate id for new memo.\n\n%1").arg(queryId.error());
-
-    int newId = queryId.record().value(0).toInt() + 1;
-    memo->_id = newId;
+    auto res = beginTransaction();
+    if (!res.isEmpty())
+        return QString("Failed to create new memo.\n\n%1").arg(res);
 
-    auto res = ActionQuery(table->sqlInsert)
+    ActionQuery query(table->sqlInsert);
+    res = query
             .param(table->parent, memo->parent() ? memo->parent()->id() : 0)
-            .param(table->id, memo->id())
             .param(table->title, memo->title())
             .param(table->type, memo->type()->name())
-            .param(table->data, memo->data())
+            .param(table->data, memo->_data)
             .param(table->created, memo->created())
             .param(table->updated, memo->updated())
             .param(table->station, memo->station())
             .exec();
     if (!res.isEmpty())
+    {
+        rollbackTransaction();
         return QString("Failed to create new memo.\n\n%1").arg(res);
+    }
+
+    bool ok;
+    int id = query.lastInsertId().toInt(&ok);
+    if (!ok)
+    {
+        rollbackTransaction();
+        return QString("Unable to get id of new memo.");
+    }
+
+    if (_isSearchIndexed)
+    {
+        using T = MemoSearchTable;
+        res = ActionQuery(T::sqlInsert)
+            .param(T::C::id, id)
+            .param(T::C::title, memo->title())
+            .param(T::C::data, memo->_data)
+            .exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return QString("Failed to index new memo.\n\n%1").arg(res);
+        }
+    }
 
+    res = commitTransaction();
+    if (!res.isEmpty())
+        return QString("Failed to create new memo.\n\n%1").arg(res);
+
+    memo->_id = id;
     return QString();
 }
 
@@ -283,42 +758,248 @@ MemosResult MemoStore::selectAll() const
     }
 
     while (query.next())
-    {
-        const auto& r = query.record();
+        result.items.append(makeItem(query.record()));
+
+    return result;
+}
 
-        Memo *memo = new Memo;
-        memo->_id = r.value(table->id).toInt();
-        memo->_title = r.value(table->title).toString();
-        memo->_type = MemoType::findByName(r.value(table->type).toString());
-        memo->_created = r.value(table->created).toDateTime();
-        memo->_updated = r.value(table->updated).toDateTime();
-        memo->_station = r.value(table->station).toString();
+MemosResult MemoStore::selectChunk(int afterId, int lastId, int limit) const
+{
+    auto table = memoTable();
+
+    MemosResult result;
 
-        int folderId = r.value(table->parent).toInt();
-        result.items.append({folderId, memo});
+    // Keyset pagination, each chunk is a cheap range scan by rowid
+    // and no statement is kept open between chunks
+    auto query = AnyQuery(table->sqlSelectChunkNoData)
+        .param(u"AfterId"_s, afterId)
+        .param(u"LastId"_s, lastId)
+        .param(u"Limit"_s, limit)
+        .exec();
+    if (query.isFailed())
+    {
+        result.error = QString("Unable to load memos.\n\n%1").arg(query.error());
+        return result;
     }
 
+    while (query.next())
+        result.items.append(makeItem(query.record()));
+
     return result;
 }
 
-QString MemoStore::load(Memo* memo) const
+MemosResult::Item MemoStore::makeItem(const QSqlRecord& r) const
 {
     auto table = memoTable();
 
-    SelectQuery query(table->sqlSelectDataById(memo->id()));
-    if (query.isFailed())
-        return QString("Unable to load memo #%1.\n\n%2").arg(memo->id()).arg(query.error());
+    Memo *memo = new Memo;
+    memo->_id = r.value(table->id).toInt();
+    memo->_title = r.value(table->title).toString();
+    memo->_type = MemoType::findByName(r.value(table->type).toString());
+    memo->_created = r.value(table->created).toLongLong();
+    memo->_updated = r.value(table->updated).toLongLong();
+    memo->_station = r.value(table->station).toString();
 
-    if (!query.next())
-        return QString("Memo #%1 does not exist.").arg(memo->id());
+    int folderId = r.value(table->parent).toInt();
+    return {folderId, memo};
+}
 
-    const auto& r = query.record();
-    memo->_data = r.value(table->data).toString();
+QString MemoStore::load(Memo* memo) const
+{
+    auto res = loadData(memo->id());
+    if (!res.error.isEmpty())
+        return res.error;
+
+    memo->_data = res.data;
     memo->_isLoaded = true;
     return QString();
 }
 
-QString MemoStore::update(Memo* memo, const MemoUpdateParam& update) const
+MemoDataResult MemoStore::loadData(int memoId) const
+{
+    auto table = memoTable();
+
+    MemoDataResult result;
+
+    QString manifest;
+    {
+        auto query = AnyQuery(table->sqlSelectData).param(table->id, memoId).exec();
+        if (query.isFailed())
+        {
+            result.error = QString("Unable to load memo #%1.\n\n%2").arg(memoId).arg(query.error());
+            return result;
+        }
+
+        if (!query.next())
+        {
+            result.error = QString("Memo #%1 does not exist.").arg(memoId);
+            return result;
+        }
+
+        manifest = query.valueStr(table->chunks);
+        if (manifest.isEmpty())
+        {
+            result.data = decodeText(query.record().value(table->data));
+            return result;
+        }
+    }
+
+    using T = MemoChunksTable;
+
+    QHash<QString, QByteArray> chunks;
+    qsizetype totalSize = 0;
+    {
+        auto query = AnyQuery(T::sqlSelect).param(T::C::memoId, memoId).exec();
+        if (query.isFailed())
+        {
+            result.error = QString("Unable to load memo #%1.\n\n%2").arg(memoId).arg(query.error());
+            return result;
+        }
+        while (query.next())
+        {
+            auto chunk = decodeBytes(query.record().value(T::C::data).toByteArray());
+            totalSize += chunk.size();
+            chunks.insert(query.valueStr(T::C::hash), chunk);
+        }
+    }
+
+    const auto hashes = manifest.split(',');
+    QByteArray bytes;
+    bytes.reserve(totalSize);
+    for (const auto& hash : hashes)
+    {
+        auto it = chunks.constFind(hash);
+        if (it == chunks.constEnd())
+        {
+            result.error = QString("Memo #%1 is damaged, its text chunk %2 is missing.").arg(memoId).arg(hash);
+            return result;
+        }
+        bytes.append(it.value());
+    }
+    result.data = QString::fromUtf8(bytes);
+    return result;
+}
+
+MemosDataResult MemoStore::loadDataMany(const QVector<int>& memoIds) const
+{
+    auto table = memoTable();
+
+    MemosDataResult result;
+
+    QStringList ids;
+    ids.reserve(memoIds.size());
+    for (int id : memoIds)
+        ids << QString::number(id);
+
+    QVector<int> chunkedIds;
+    {
+        auto query = AnyQuery(table->sqlSelectDataMany).param(u"Ids"_s, '[' + ids.join(',') + ']').exec();
+        if (query.isFailed())
+        {
+            result.error = QString("Unable to load memos.\n\n%1").arg(query.error());
+            return result;
+        }
+        while (query.next())
+        {
+            int id = query.record().value(table->id).toInt();
+            if (query.valueStr(table->chunks).isEmpty())
+                result.data.insert(id, decodeText(query.record().value(table->data)));
+            else chunkedIds << id;
+        }
+    }
+
+    // Chunked memos are assembled separately, there are few of them
+    for (int id : std::as_const(chunkedIds))
+    {
+        auto res = loadData(id);
+        if (!res.error.isEmpty())
+        {
+            result.error = res.error;
+            return result;
+        }
+        result.data.insert(id, res.data);
+    }
+
+    return result;
+}
+
+QString MemoStore::writeData(int memoId, const QString& data) const
+{
+    auto table = memoTable();
+
+    using T = MemoChunksTable;
+
+    QString oldManifest;
+    {
+        auto query = AnyQuery(table->sqlSelectChunks).param(table->id, memoId).exec();
+        if (query.isFailed()) return query.error();
+        if (query.next())
+            oldManifest = query.valueStr(table->chunks);
+    }
+
+    if (data.size() < CHUNKED_DATA_MIN_SIZE)
+    {
+        if (!oldManifest.isEmpty())
+        {
+            auto res = ActionQuery(T::sqlDeleteAll).param(T::C::memoId, memoId).exec();
+            if (!res.isEmpty()) return res;
+        }
+        return ActionQuery(table->sqlUpdateData)
+            .param(table->id, memoId)
+            .param(table->data, encodeText(data))
+            .param(table->chunks, QVariant())
+            .exec();
+    }
+
+    // Only chunks that are not stored yet are written,
+    // a small edit of a huge memo touches one or two chunks and the manifest
+    QSet<QString> oldHashes;
+    if (!oldManifest.isEmpty())
+    {
+        const auto hashes = oldManifest.split(',');
+        oldHashes = QSet<QString>(hashes.begin(), hashes.end());
+    }
+
+    const auto bytes = data.toUtf8();
+    const auto chunks = splitIntoChunks(bytes);
+    QStringList manifest;
+    manifest.reserve(chunks.size());
+    QSet<QString> newHashes;
+    for (const auto& chunk : chunks)
+    {
+        auto hash = chunkHash(chunk);
+        manifest << hash;
+        if (oldHashes.contains(hash) || newHashes.contains(hash))
+            continue;
+        newHashes << hash;
+        auto res = ActionQuery(T::sqlInsert)
+            .param(T::C::memoId, memoId)
+            .param(T::C::hash, hash)
+            .param(T::C::data, encodeChunk(chunk))
+            .exec();
+        if (!res.isEmpty()) return res;
+    }
+
+    QSet<QString> usedHashes(manifest.begin(), manifest.end());
+    for (const auto& hash : std::as_const(oldHashes))
+    {
+        if (usedHashes.contains(hash))
+            continue;
+        auto res = ActionQuery(T::sqlDelete)
+            .param(T::C::memoId, memoId)
+            .param(T::C::hash, hash)
+            .exec();
+        if (!res.isEmpty()) return res;
+    }
+
+    return ActionQuery(table->sqlUpdateData)
+        .param(table->id, memoId)
+        .param(table->data, QVariant())
+        .param(table->chunks, manifest.join(','))
+        .exec();
+}
+
+QString MemoStore::update(int memoId, const MemoUpdateParam& update) const
 {
     auto table = memoTable();
 
@@ -326,17 +1007,13 @@ QString MemoStore::update(Memo* memo, const MemoUpdateParam& update) const
     sql << u"UPDATE Memo SET"_s;
     if (update.title)
         sql << u"Title = :Title,"_s;
-    if (update.data)
-        sql << u"Data = :Data,"_s;
     if (update.station)
         sql << u"Station = :Station,"_s;
     sql << u"Updated = :Updated WHERE Id = :Id"_s;
 
-    auto q = AnyQuery(sql.join(' ')).param(table->id, memo->id());
+    auto q = AnyQuery(sql.join(' ')).param(table->id, memoId);
     if (update.title)
         q.param(table->title, *update.title);
-    if (update.data)
-        q.param(table->data, *update.data);
     if (update.station)
         q.param(table->station, *update.station);
     if (update.moment)
@@ -345,7 +1022,55 @@ QString MemoStore::update(Memo* memo, const MemoUpdateParam& update) const
         q.param(table->updated, QDateTime::currentDateTime());
 
     q.exec();
-    return q.error();
+    if (q.isFailed())
+        return q.error();
+
+    if (update.data)
+    {
+        auto res = writeData(memoId, *update.data);
+        if (!res.isEmpty()) return res;
+    }
+
+    if (_isSearchIndexed && (update.title || update.data))
+    {
+        // It's called inside of a transaction, see Enot::writeMemo.
+        // The index row is replaced with the whole title and text, so the missing one is taken from DB
+        QString title;
+        bool isChunked;
+        {
+            auto q = AnyQuery(table->sqlSelectTitle).param(table->id, memoId).exec();
+            if (q.isFailed()) return q.error();
+            if (!q.next()) return QString();
+            title = q.valueStr(table->title);
+            isChunked = !q.valueStr(table->chunks).isEmpty();
+        }
+        if (isChunked)
+        {
+            // FTS5 reindexes the whole text, for a huge memo it would undo
+            // the gain of writing only changed chunks, so it's deferred, see reindexStale()
+            QMutexLocker lock(&_staleSearchMutex);
+            _staleSearchIds << memoId;
+            return QString();
+        }
+        QString data;
+        if (update.data)
+            data = *update.data;
+        else
+        {
+            auto loaded = loadData(memoId);
+            if (!loaded.error.isEmpty()) return loaded.error;
+            data = loaded.data;
+        }
+        using T = MemoSearchTable;
+        auto res = ActionQuery(T::sqlReplace)
+            .param(T::C::id, memoId)
+            .param(T::C::title, title)
+            .param(T::C::data, data)
+            .exec();
+        if (!res.isEmpty()) return res;
+    }
+
+    return QString();
 }
 
 QString MemoStore::remove(Memo* memo) const
@@ -356,6 +1081,56 @@ QString MemoStore::remove(Memo* memo) const
             .exec();
 }
 
+QString MemoStore::selectBranchMemos(int folderId, RemoveQueue& queue) const
+{
+    auto table = memoTable();
+    auto q = AnyQuery(table->sqlSelectBranch).param(table->id, folderId).exec();
+    if (q.isFailed())
+        return QString("Unable to get memos of folder #%1.\n\n%2").arg(folderId).arg(q.error());
+    while (q.next())
+        queue.memoIds << q.record().value(0).toInt();
+    return QString();
+}
+
+QString MemoStore::removeNext(RemoveQueue& queue, int limit) const
+{
+    auto table = memoTable();
+
+    // Each portion is a separate transaction, so other writes are not locked out for long
+    auto res = beginTransaction();
+    if (!res.isEmpty()) return res;
+
+    qsizetype pos = queue.memoPos;
+    for (int count = 0; count < limit && pos < queue.memoIds.size(); count++, pos++)
+    {
+        // Props, chunks, sheets, and search index rows are deleted by FK relations and triggers
+        int id = queue.memoIds.at(pos);
+        res = ActionQuery(table->sqlDelete).param(table->id, id).exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return QString("Failed to delete memo #%1.\n\n%2").arg(id).arg(res);
+        }
+    }
+
+    res = commitTransaction();
+    if (res.isEmpty())
+        queue.memoPos = pos;
+    return res;
+}
+
+QString MemoStore::maxId(int* id) const
+{
+    auto table = memoTable();
+    SelectQuery query(table->sqlSelectMaxId);
+    if (query.isFailed()) return query.error();
+
+    query.next();
+    // NULL for an empty table gives 0
+    *id = query.record().value(0).toInt();
+    return QString();
+}
+
 QString MemoStore::countAll(int *count) const
 {
     auto table = memoTable();
@@ -413,6 +1188,46 @@ QHash<QString, QString> MemoStore::loadProps(int memoId) const
     return result;
 }
 
+namespace {
+
+PropsResult fetchProps(AnyQuery& q)
+{
+    using T = MemoPropsTable;
+
+    PropsResult result;
+    if (q.isFailed())
+    {
+        result.error = q.error();
+        return result;
+    }
+
+    while (q.next())
+    {
+        const auto& r = q.record();
+        result.items[r.value(T::C::memoId).toInt()].insert(
+            r.value(T::C::name).toString(), r.value(T::C::value).toString());
+    }
+    return result;
+}
+
+} // namespace
+
+PropsResult MemoStore::loadAllProps() const
+{
+    using T = MemoPropsTable;
+
+    auto q = AnyQuery(T::sqlSelectAll).exec();
+    return fetchProps(q);
+}
+
+PropsResult MemoStore::loadFolderProps(int folderId) const
+{
+    using T = MemoPropsTable;
+
+    auto q = AnyQuery(T::sqlSelectByFolder).param(T::C::folderId, folderId).exec();
+    return fetchProps(q);
+}
+
 QStringList MemoStore::loadPropNames() const
 {
     using T = MemoPropsTable;
@@ -470,20 +1285,489 @@ QString MemoStore::updateProp(int memoId, const QString& name, const QString& va
         .error();
 }
 
-QStringList MemoStore::loadSheets(int memoId) const
+namespace {
+
+QString makeMatchQuery(const QString& text)
+{
+    // Each term is quoted, so special chars and FTS operators typed by user don't break the query.
+    // The last term is matched as prefix to get results while typing
+    QStringList terms;
+    const auto words = text.simplified().split(' ', Qt::SkipEmptyParts);
+    for (const auto& word : words)
+        terms << '"' + QString(word).replace('"', "\"\""_L1) + '"';
+    if (!terms.isEmpty())
+        terms.last() += '*';
+    return terms.join(' ');
+}
+
+// Number of chars taken around the found word
+const qsizetype SNIPPET_CONTEXT = 60;
+
+/// Makes a piece of text around the first found word.
+/// Words are found as substrings ignoring case, it's enough for a preview in search results.
+QString makeSnippet(const QString& data, const QString& text)
+{
+    if (data.isEmpty())
+        return {};
+
+    qsizetype pos = -1, len = 0;
+    const auto words = text.simplified().split(' ', Qt::SkipEmptyParts);
+    for (const auto& word : words)
+    {
+        qsizetype p = data.indexOf(word, 0, Qt::CaseInsensitive);
+        if (p >= 0 && (pos < 0 || p < pos))
+        {
+            pos = p;
+            len = word.size();
+        }
+    }
+    // The match is only in title or differs by diacritics, show the beginning of text then
+    if (pos < 0)
+        pos = 0;
+
+    qsizetype start = qMax(qsizetype(0), pos - SNIPPET_CONTEXT);
+    qsizetype end = qMin(data.size(), pos + len + SNIPPET_CONTEXT);
+    // Don't cut words at the edges
+    if (start > 0)
+    {
+        qsizetype space = data.indexOf(' ', start);
+        if (space >= 0 && space < pos)
+            start = space + 1;
+    }
+    if (end < data.size())
+    {
+        qsizetype space = data.lastIndexOf(' ', end);
+        if (space > pos + len)
+            end = space;
+    }
+
+    QString snippet = data.mid(start, end - start).simplified();
+    if (start > 0)
+        snippet = "..." + snippet;
+    if (end < data.size())
+        snippet += "...";
+    return snippet;
+}
+
+} // namespace
+
+SearchResult MemoStore::search(const QString& text, int limit) const
+{
+    using T = MemoSearchTable;
+
+    SearchResult result;
+
+    if (!_isSearchEnabled)
+    {
+        result.error = _isSearchIndexed
+            ? QString("Search index is being built, try again later.")
+            : QString("Full-text search is not available.");
+        return result;
+    }
+
+    auto matchQuery = makeMatchQuery(text);
+    if (matchQuery.isEmpty())
+        return result;
+
+    auto q = AnyQuery(T::sqlSearch)
+        .param(T::C::query, matchQuery)
+        .param(T::C::limit, limit)
+        .exec();
+    if (q.isFailed())
+    {
+        result.error = QString("Unable to search memos.\n\n%1").arg(q.error());
+        return result;
+    }
+
+    QVector<int> ids;
+    while (q.next())
+        ids << q.record().value(T::C::id).toInt();
+    if (ids.isEmpty())
+        return result;
+
+    // The index has no texts, snippets are made from texts loaded in one query
+    auto texts = loadDataMany(ids);
+    if (!texts.error.isEmpty())
+        qWarning() << "Unable to load texts for search snippets" << texts.error;
+
+    for (int id : std::as_const(ids))
+        result.items.append({id, makeSnippet(texts.data.value(id), text)});
+    return result;
+}
+
+QString MemoStore::rebuildSearchIndex()
+{
+    using T = MemoSearchTable;
+
+    if (!_isSearchIndexed)
+        return QString("Full-text search is not available.");
+
+    auto res = beginTransaction();
+    if (!res.isEmpty()) return res;
+
+    res = ActionQuery(T::sqlClear).exec();
+    if (res.isEmpty())
+        res = ActionQuery(T::sqlQueueAll).exec();
+    if (!res.isEmpty())
+    {
+        rollbackTransaction();
+        return res;
+    }
+
+    res = commitTransaction();
+    if (res.isEmpty())
+        _isSearchEnabled = false;
+    return res;
+}
+
+bool MemoStore::hasStaleSearchIndex() const
+{
+    QMutexLocker lock(&_staleSearchMutex);
+    return !_staleSearchIds.isEmpty();
+}
+
+QString MemoStore::reindexStale() const
+{
+    using T = MemoSearchTable;
+
+    QSet<int> ids;
+    {
+        QMutexLocker lock(&_staleSearchMutex);
+        ids.swap(_staleSearchIds);
+    }
+    if (ids.isEmpty() || !_isSearchIndexed)
+        return QString();
+
+    // Memos are indexed one by one to not hold a write lock for long,
+    // the current text is taken, so memos saved again meanwhile are indexed correctly
+    auto table = memoTable();
+    for (auto it = ids.cbegin(); it != ids.cend(); it++)
+    {
+        QString title;
+        {
+            auto q = AnyQuery(table->sqlSelectTitle).param(table->id, *it).exec();
+            if (q.isFailed() || !q.next())
+            {
+                // The memo could be deleted meanwhile, its index row is deleted by the trigger then
+                qWarning() << "Unable to reindex memo" << *it << q.error();
+                continue;
+            }
+            title = q.valueStr(table->title);
+        }
+        auto data = loadData(*it);
+        if (!data.error.isEmpty())
+        {
+            qWarning() << "Unable to reindex memo" << *it << data.error;
+            continue;
+        }
+        auto res = ActionQuery(T::sqlReplace)
+            .param(T::C::id, *it)
+            .param(T::C::title, title)
+            .param(T::C::data, data.data)
+            .exec();
+        if (!res.isEmpty())
+        {
+            // Leave the rest for the next time
+            QMutexLocker lock(&_staleSearchMutex);
+            for (; it != ids.cend(); it++)
+                _staleSearchIds << *it;
+            return res;
+        }
+    }
+    return QString();
+}
+
+QString MemoStore::fillSearchIndexNext(int limit)
+{
+    using T = MemoSearchTable;
+
+    if (!_isSearchIndexed || _isSearchEnabled)
+        return QString();
+
+    struct Item { int id; bool exists; QString title; QVariant data; QString chunks; };
+    QList<Item> items;
+    {
+        auto q = AnyQuery(T::sqlSelectQueued).param(T::C::limit, limit).exec();
+        if (q.isFailed()) return q.error();
+        while (q.next())
+        {
+            auto r = q.record();
+            items.append({
+                .id = r.value(T::C::id).toInt(),
+                .exists = !r.value(u"MemoId"_s).isNull(),
+                .title = r.value(T::C::title).toString(),
+                .data = r.value(T::C::data),
+                .chunks = r.value(u"Chunks"_s).toString(),
+            });
+        }
+    }
+
+    // Each portion is a separate transaction, so other writes are not locked out for long
+    auto res = beginTransaction();
+    if (!res.isEmpty()) return res;
+
+    int lastId = 0;
+    qsizetype size = 0;
+    for (const auto& item : std::as_const(items))
+    {
+        lastId = item.id;
+        if (!item.exists)
+            continue;
+
+        QString data;
+        if (item.chunks.isEmpty())
+            data = decodeText(item.data);
+        else
+        {
+            // Chunked memos are rare but large, they are assembled one at a time
+            auto loaded = loadData(item.id);
+            if (!loaded.error.isEmpty())
+                // Don't stop indexing of the whole notebook because of a damaged memo, index its title at least
+                qWarning() << "Unable to index memo" << item.id << loaded.error;
+            data = loaded.data;
+        }
+
+        res = ActionQuery(T::sqlReplace)
+            .param(T::C::id, item.id)
+            .param(T::C::title, item.title)
+            .param(T::C::data, data)
+            .exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return res;
+        }
+
+        // Don't hold the write lock for long when there are many large memos
+        size += data.size();
+        if (size >= SEARCH_FILL_MAX_SIZE)
+            break;
+    }
+
+    if (lastId > 0)
+    {
+        res = ActionQuery(T::sqlDequeue).param(T::C::id, lastId).exec();
+        if (!res.isEmpty())
+        {
+            rollbackTransaction();
+            return res;
+        }
+    }
+
+    res = commitTransaction();
+    if (!res.isEmpty()) return res;
+
+    if (items.isEmpty())
+        _isSearchEnabled = true;
+    return QString();
+}
+
+QString MemoStore::countSheets(int memoId, int* count) const
 {
     using T = MemoSheetsTable;
 
-    auto q = AnyQuery(T::sqlSelect).param(T::C::memoId, memoId).exec();
+    auto q = AnyQuery(T::sqlCount).param(T::C::memoId, memoId).exec();
+    if (q.isFailed()) return q.error();
+
+    q.next();
+    *count = q.record().value(0).toInt();
+    return QString();
+}
+
+SheetsResult MemoStore::loadSheets(int memoId, int offset, int limit) const
+{
+    using T = MemoSheetsTable;
+
+    SheetsResult result;
+
+    auto q = AnyQuery(T::sqlSelectPage)
+        .param(T::C::memoId, memoId)
+        .param(T::C::offset, offset)
+        .param(T::C::limit, limit)
+        .exec();
     if (q.isFailed())
     {
-        // TODO: add protocol
-        qWarning() << "Unable to load sheets for memo" << memoId << q.error();
-        return {};
+        result.error = QString("Unable to load sheets for memo %1.\n\n%2").arg(memoId).arg(q.error());
+        return result;
     }
 
-    QStringList result;
     while (q.next())
-        result.append(q.valueStr(T::C::data));
+    {
+        auto r = q.record();
+        result.items.append({
+            .id = r.value(T::C::id).toInt(),
+            .created = r.value(T::C::created).toLongLong(),
+            .updated = r.value(T::C::updated).toLongLong(),
+            .station = r.value(T::C::station).toString(),
+            .data = decodeText(r.value(T::C::data)),
+        });
+    }
     return result;
+}
+
+QVariant MemoStore::encodeText(const QString& text) const
+{
+    if (_isCompressionEnabled)
+    {
+        auto compressed = compressBytes(text.toUtf8());
+        if (!compressed.isEmpty())
+            return compressed;
+    }
+    return text;
+}
+
+QByteArray MemoStore::encodeChunk(QByteArrayView chunk) const
+{
+    if (_isCompressionEnabled)
+    {
+        auto compressed = compressBytes(chunk);
+        if (!compressed.isEmpty())
+            return compressed;
+    }
+    return chunk.toByteArray();
+}
+
+namespace {
+
+QString selectRecodableIds(const QString& sql, bool compress, QVector<int>& ids)
+{
+    auto q = AnyQuery(sql).param(u"Compress"_s, compress).param(u"MinSize"_s, COMPRESS_MIN_SIZE).exec();
+    if (q.isFailed()) return q.error();
+    while (q.next())
+        ids << q.record().value(0).toInt();
+    return QString();
+}
+
+} // namespace
+
+QString MemoStore::selectRecodable(RecodeQueue& queue) const
+{
+    // Keys are collected once and rows are rewritten by portions, then the whole notebook
+    // is never held in memory, and the select is not affected by updates.
+    // Rows written after this are stored in the new mode already
+    const bool compress = _isCompressionEnabled;
+
+    auto res = selectRecodableIds(memoTable()->sqlSelectRecodable, compress, queue.memoIds);
+    if (!res.isEmpty())
+        return QString("Unable to recompress memos.\n\n%1").arg(res);
+
+    {
+        using T = MemoChunksTable;
+        auto q = AnyQuery(T::sqlSelectRecodable)
+            .param(T::C::compress, compress)
+            .param(u"MinSize"_s, COMPRESS_MIN_SIZE)
+            .exec();
+        if (q.isFailed())
+            return QString("Unable to recompress memos.\n\n%1").arg(q.error());
+        while (q.next())
+            queue.chunkKeys.append({q.record().value(T::C::memoId).toInt(), q.valueStr(T::C::hash)});
+    }
+
+    res = selectRecodableIds(MemoSheetsTable::sqlSelectRecodable, compress, queue.sheetIds);
+    if (!res.isEmpty())
+        return QString("Unable to recompress memos.\n\n%1").arg(res);
+
+    return QString();
+}
+
+QString MemoStore::recodeNext(RecodeQueue& queue, int limit) const
+{
+    // Each portion is a separate transaction, so other writes are not locked out for long
+    auto res = beginTransaction();
+    if (!res.isEmpty()) return res;
+
+    auto fail = [](const QString& error){
+        rollbackTransaction();
+        return QString("Unable to recompress memos.\n\n%1").arg(error);
+    };
+
+    // The queue is advanced only when the transaction is committed,
+    // then a failed portion can be retried
+    qsizetype memoPos = queue.memoPos, chunkPos = queue.chunkPos, sheetPos = queue.sheetPos;
+    int count = 0;
+
+    {
+        auto table = memoTable();
+        for (; count < limit && memoPos < queue.memoIds.size(); count++, memoPos++)
+        {
+            int id = queue.memoIds.at(memoPos);
+            QVariant data;
+            {
+                auto q = AnyQuery(table->sqlSelectData).param(table->id, id).exec();
+                if (q.isFailed()) return fail(q.error());
+                if (q.next())
+                    data = q.record().value(table->data);
+            }
+            // The memo could be deleted or become chunked since the keys were collected
+            if (data.isNull())
+                continue;
+            // Incompressible texts stay plain, don't rewrite them with the same value
+            auto encoded = encodeText(decodeText(data));
+            if (encoded == data)
+                continue;
+            res = ActionQuery(table->sqlUpdateDataOnly)
+                .param(table->id, id)
+                .param(table->data, encoded)
+                .exec();
+            if (!res.isEmpty()) return fail(res);
+        }
+    }
+
+    {
+        using T = MemoChunksTable;
+        for (; count < limit && chunkPos < queue.chunkKeys.size(); count++, chunkPos++)
+        {
+            const auto& key = queue.chunkKeys.at(chunkPos);
+            QByteArray data;
+            {
+                auto q = AnyQuery(T::sqlSelectOne).param(T::C::memoId, key.first).param(T::C::hash, key.second).exec();
+                if (q.isFailed()) return fail(q.error());
+                if (!q.next()) continue;
+                data = q.record().value(T::C::data).toByteArray();
+            }
+            auto encoded = encodeChunk(decodeBytes(data));
+            if (encoded == data)
+                continue;
+            res = ActionQuery(T::sqlUpdate)
+                .param(T::C::memoId, key.first)
+                .param(T::C::hash, key.second)
+                .param(T::C::data, encoded)
+                .exec();
+            if (!res.isEmpty()) return fail(res);
+        }
+    }
+
+    {
+        using T = MemoSheetsTable;
+        for (; count < limit && sheetPos < queue.sheetIds.size(); count++, sheetPos++)
+        {
+            int id = queue.sheetIds.at(sheetPos);
+            QVariant data;
+            {
+                auto q = AnyQuery(T::sqlSelectById).param(T::C::id, id).exec();
+                if (q.isFailed()) return fail(q.error());
+                if (q.next())
+                    data = q.record().value(T::C::data);
+            }
+            if (data.isNull())
+                continue;
+            auto encoded = encodeText(decodeText(data));
+            if (encoded == data)
+                continue;
+            res = ActionQuery(T::sqlUpdateData)
+                .param(T::C::id, id)
+                .param(T::C::data, encoded)
+                .exec();
+            if (!res.isEmpty()) return fail(res);
+        }
+    }
+
+    res = commitTransaction();
+    if (!res.isEmpty())
+        return QString("Unable to recompress memos.\n\n%1").arg(res);
+
+    queue.memoPos = memoPos;
+    queue.chunkPos = chunkPos;
+    queue.sheetPos = sheetPos;
+    return QString();
 }
\ No newline at end of file
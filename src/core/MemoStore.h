@@ -3,11 +3,19 @@
 
 #include <QString>
 #include <QHash>
+#include <QMutex>
+#include <QSet>
 #include <QVariant>
 
+#include <atomic>
+
 class Memo;
 struct MemoUpdateParam;
 
+QT_BEGIN_NAMESPACE
+class QSqlRecord;
+QT_END_NAMESPACE
+
 struct MemosResult
 {
     QString error;
@@ -17,25 +25,145 @@ struct MemosResult
     QList<Item> items;
 };
 
+struct MemoDataResult
+{
+    QString error;
+    QString data;
+};
+
+struct MemosDataResult
+{
+    QString error;
+    QHash<int, QString> data;
+};
+
+struct SheetsResult
+{
+    QString error;
+
+    struct Item
+    {
+        int id;
+        qint64 created;
+        qint64 updated;
+        QString station;
+        QString data;
+    };
+    QList<Item> items;
+};
+
+/// Rows to be rewritten when the compression mode is changed.
+struct RecodeQueue
+{
+    QVector<int> memoIds;
+    QList<QPair<int, QString>> chunkKeys;
+    QVector<int> sheetIds;
+    // Rows before these positions are already rewritten
+    qsizetype memoPos = 0, chunkPos = 0, sheetPos = 0;
+
+    bool isDone() const
+    {
+        return memoPos >= memoIds.size() && chunkPos >= chunkKeys.size() && sheetPos >= sheetIds.size();
+    }
+};
+
+/// Memos to be deleted by portions, e.g. of a folder branch being deleted.
+struct RemoveQueue
+{
+    QVector<int> memoIds;
+    // Memos before this position are already deleted
+    qsizetype memoPos = 0;
+
+    bool isDone() const { return memoPos >= memoIds.size(); }
+};
+
+struct SearchResult
+{
+    QString error;
+
+    struct Item { int memoId; QString snippet; };
+    QList<Item> items;
+};
+
+struct PropsResult
+{
+    QString error;
+    QHash<int, QHash<QString, QString>> items;
+};
+
 class MemoStore
 {
 public:
     QString prepare();
 
     QString create(Memo* memo) const;
-    QString update(Memo *memo, const MemoUpdateParam& update) const;
+    QString update(int memoId, const MemoUpdateParam& update) const;
     QString remove(Memo* memo) const;
+    /// Collects memos of the folder and all its subfolders.
+    QString selectBranchMemos(int folderId, RemoveQueue& queue) const;
+    /// Deletes the next `limit` memos of the queue in one transaction.
+    QString removeNext(RemoveQueue& queue, int limit) const;
     QString load(Memo *memo) const;
+    MemoDataResult loadData(int memoId) const;
+    MemosDataResult loadDataMany(const QVector<int>& memoIds) const;
     MemosResult selectAll() const;
+    /// Memos with ids in range (afterId, lastId], lastId limits loading to memos existing when it started.
+    MemosResult selectChunk(int afterId, int lastId, int limit) const;
+    QString maxId(int* id) const;
     QString countAll(int* count) const;
     QHash<QString, QVariant> selectOptions(int memoId) const;
     QString updateOption(int memoId, const QString& name, const QVariant& value) const;
     QHash<QString, QString> loadProps(int memoId) const;
+    PropsResult loadAllProps() const;
+    PropsResult loadFolderProps(int folderId) const;
     QStringList loadPropNames() const;
     QStringList loadPropValues(const QString& name) const;
     QString deleteProp(int memoId, const QString& name) const;
     QString updateProp(int memoId, const QString& name, const QString& value) const;
-    QStringList loadSheets(int memoId) const;
+    QString countSheets(int memoId, int* count) const;
+    /// Sheets go from the newest to the oldest one, the offset is counted from the newest one.
+    SheetsResult loadSheets(int memoId, int offset, int limit) const;
+
+    /// New and updated memo texts are stored compressed.
+    /// Titles and props are never compressed, they are used by the tree and grids.
+    bool isCompressionEnabled() const { return _isCompressionEnabled; }
+    void setCompressionEnabled(bool on) { _isCompressionEnabled = on; }
+    /// Collects stored texts not matching the current compression mode.
+    QString selectRecodable(RecodeQueue& queue) const;
+    /// Rewrites the next `limit` rows of the queue according to the current compression mode.
+    QString recodeNext(RecodeQueue& queue, int limit) const;
+
+    /// Search is enabled when the index is filled.
+    bool isSearchEnabled() const { return _isSearchEnabled; }
+    /// The index is kept up to date, though it can be still being filled.
+    bool isSearchIndexed() const { return _isSearchIndexed; }
+    SearchResult search(const QString& text, int limit) const;
+    /// Clears the index and queues all memos for indexing, search is disabled until they are indexed.
+    QString rebuildSearchIndex();
+    /// Indexes the next `limit` queued memos in one transaction, it's done in the storage thread.
+    /// Search gets enabled when the queue is empty.
+    QString fillSearchIndexNext(int limit);
+    /// Search index of large memos is not updated when they are saved,
+    /// they are reindexed later when the user stops editing.
+    bool hasStaleSearchIndex() const;
+    QString reindexStale() const;
+
+private:
+    // Search flags are checked in the GUI thread and in the storage thread
+    std::atomic<bool> _isSearchIndexed = false;
+    std::atomic<bool> _isSearchEnabled = false;
+    // Memos are written in the storage thread too
+    std::atomic<bool> _isCompressionEnabled = false;
+    // Memos are saved in the GUI thread and in the storage thread
+    mutable QMutex _staleSearchMutex;
+    mutable QSet<int> _staleSearchIds;
+
+    void prepareSearch();
+    QString writeData(int memoId, const QString& data) const;
+    QVariant encodeText(const QString& text) const;
+    QByteArray encodeChunk(QByteArrayView chunk) const;
+
+    MemosResult::Item makeItem(const QSqlRecord& r) const;
 };
 
 namespace Store
@@ -29,6 +29,8 @@ public:
 
     const QString sqlInsert = "INSERT INTO Settings (Id, Value) VALUES (:Id, :Value)";
     const QString sqlUpdate = "UPDATE Settings SET Value = :Value WHERE Id = :Id";
+    const QString sqlCheck = "SELECT Id FROM Settings WHERE Id = :Id LIMIT 1";
+    const QString sqlSelect = "SELECT Value FROM Settings WHERE Id = :Id";
 };
 
 SettingsTableDef* settingsTable() { static SettingsTableDef t; return &t; }
@@ -79,7 +81,7 @@ QString SettingsStore::writeValue(const QString& id, const QVariant& value) cons
 {
     auto table = settingsTable();
 
-    SelectQuery query(table->sqlCheckId(id));
+    auto query = AnyQuery(table->sqlCheck).param(table->id, id).exec();
     if (query.isFailed())
     {
         qWarning() << "Unable to write setting" << id << query.error();
@@ -102,7 +104,7 @@ QVariant SettingsStore::readValue(const QString& id, const QVariant& defValue, b
 {
     auto table = settingsTable();
 
-    SelectQuery query(table->sqlSelectById(id));
+    auto query = AnyQuery(table->sqlSelect).param(table->id, id).exec();
     if (query.isFailed())
     {
         qWarning() << "Unable to read setting" << id << query.error();
@@ -116,7 +118,7 @@ QVariant SettingsStore::readValue(const QString& id, const QVariant& defValue, b
     }
     if (hasValue)
         *hasValue = true;
-    return query.record().field(table->value).value();
+    return query.record().value(table->value);
 }
 
 QString SettingsStore::writeString(const QString& id, const QString& value) const
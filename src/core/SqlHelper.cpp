@@ -1,5 +1,11 @@
 #include "SqlHelper.h"
 
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+
+#include <algorithm>
+
 namespace SqlHelper {
 
 void addField(QSqlRecord &record, const QString &name, QMetaType type, const QVariant &value)
@@ -49,6 +55,487 @@ QString errorText(const QSqlError &error)
 namespace Ori {
 namespace Sql {
 
+//------------------------------------------------------------------------------
+//                             Thread connection
+//------------------------------------------------------------------------------
+
+namespace {
+
+thread_local QString threadConnection;
+
+} // namespace
+
+QString threadConnectionName()
+{
+    if (threadConnection.isEmpty())
+        return QLatin1String(QSqlDatabase::defaultConnection);
+    return threadConnection;
+}
+
+void setThreadConnectionName(const QString& connectionName)
+{
+    threadConnection = connectionName;
+}
+
+QSqlDatabase threadDatabase()
+{
+    return QSqlDatabase::database(threadConnectionName());
+}
+
+//------------------------------------------------------------------------------
+//                               StatementCache
+//------------------------------------------------------------------------------
+
+namespace {
+
+// SQL texts built with literal values (e.g. via QString::arg) never repeat,
+// when the cache is full they are evicted as the least recently used ones.
+const int MAX_CACHED_STATEMENTS = 256;
+
+QMutex& cachesMutex()
+{
+    static QMutex m;
+    return m;
+}
+
+QHash<QString, StatementCache*>& caches()
+{
+    static QHash<QString, StatementCache*> c;
+    return c;
+}
+
+} // namespace
+
+StatementCache* StatementCache::instance(const QString& connectionName)
+{
+    QMutexLocker lock(&cachesMutex());
+    auto cache = caches().value(connectionName);
+    if (!cache)
+    {
+        cache = new StatementCache(connectionName);
+        caches().insert(connectionName, cache);
+    }
+    return cache;
+}
+
+void StatementCache::clear(const QString& connectionName)
+{
+    QMutexLocker lock(&cachesMutex());
+    auto cache = caches().value(connectionName);
+    if (cache)
+        cache->reset();
+}
+
+StatementCache::~StatementCache()
+{
+    reset();
+}
+
+void StatementCache::reset()
+{
+    for (auto statement : std::as_const(_statements))
+    {
+        // A statement still in use will be deleted when released
+        if (statement->busy)
+            statement->cached = false;
+        else
+            delete statement;
+    }
+    _statements.clear();
+    _hits = 0;
+    _misses = 0;
+}
+
+StatementCache::Statement* StatementCache::acquire(const QString& sql)
+{
+    auto statement = _statements.value(sql);
+    if (statement && !statement->busy)
+    {
+        _hits++;
+        statement->busy = true;
+        statement->lastUse = ++_useCounter;
+        return statement;
+    }
+
+    _misses++;
+
+    // The same statement can be requested again while the previous one
+    // is still iterating (e.g. in nested loops), then it gets a temporary copy
+    statement = new Statement { .query = QSqlQuery(QSqlDatabase::database(_connectionName)), .busy = true };
+    if (statement->query.prepare(sql) && !_statements.contains(sql))
+    {
+        if (_statements.size() >= MAX_CACHED_STATEMENTS)
+            evictLeastUsed();
+        statement->cached = true;
+        statement->lastUse = ++_useCounter;
+        _statements.insert(sql, statement);
+    }
+    return statement;
+}
+
+void StatementCache::evictLeastUsed()
+{
+    // The cache is small and it's only done on misses, a linear scan is cheap enough
+    auto oldest = _statements.end();
+    for (auto it = _statements.begin(); it != _statements.end(); it++)
+        if (oldest == _statements.end() || it.value()->lastUse < oldest.value()->lastUse)
+            oldest = it;
+    if (oldest == _statements.end())
+        return;
+
+    auto statement = oldest.value();
+    // A statement still in use will be deleted when released
+    if (statement->busy)
+        statement->cached = false;
+    else
+        delete statement;
+    _statements.erase(oldest);
+}
+
+void StatementCache::release(Statement* statement)
+{
+    if (!statement->cached)
+    {
+        delete statement;
+        return;
+    }
+    // Reset the statement to make it ready for the next execution
+    // but keep it prepared, only new values will be bound
+    statement->query.finish();
+    statement->busy = false;
+}
+
+//------------------------------------------------------------------------------
+//                                QueryStats
+//------------------------------------------------------------------------------
+
+namespace {
+
+const int MAX_LATENCY_SAMPLES = 1000;
+const int MAX_SLOW_QUERIES = 100;
+
+// Like for the statement cache, SQL texts with literal values should not bloat the stats,
+// when there are too many distinct texts new ones are counted together
+const int MAX_COUNTERS = 2000;
+const QString OTHER_QUERIES = QStringLiteral("(other queries)");
+
+qint64 percentile(QVector<qint64> samples, double p)
+{
+    if (samples.isEmpty()) return 0;
+    int index = qMin(int(samples.size() * p), samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples.at(index);
+}
+
+QString formatMs(qint64 ns)
+{
+    return QString::number(ns / 1e6, 'f', 3);
+}
+
+} // namespace
+
+QueryStats* QueryStats::instance()
+{
+    static QueryStats stats;
+    return &stats;
+}
+
+void QueryStats::record(const QString& sql, qint64 elapsedNs, qint64 rows)
+{
+    QMutexLocker lock(&_mutex);
+
+    auto it = _counters.find(sql);
+    if (it == _counters.end())
+    {
+        if (_counters.size() < MAX_COUNTERS)
+            it = _counters.insert(sql, Counter());
+        else
+        {
+            it = _counters.find(OTHER_QUERIES);
+            if (it == _counters.end())
+                it = _counters.insert(OTHER_QUERIES, Counter());
+        }
+    }
+
+    auto& c = it.value();
+    c.count++;
+    c.totalNs += elapsedNs;
+    c.rows += rows;
+    if (elapsedNs > c.maxNs)
+        c.maxNs = elapsedNs;
+    if (c.samples.size() < MAX_LATENCY_SAMPLES)
+        c.samples << elapsedNs;
+    else
+    {
+        c.samples[c.nextSample] = elapsedNs;
+        c.nextSample = (c.nextSample + 1) % MAX_LATENCY_SAMPLES;
+    }
+
+    if (elapsedNs >= qint64(_slowThresholdMs) * 1000000)
+    {
+        SlowQuery q { .sql = sql, .elapsedNs = elapsedNs, .rows = rows, .moment = QDateTime::currentDateTime() };
+        if (_slowQueries.size() < MAX_SLOW_QUERIES)
+            _slowQueries << q;
+        else
+        {
+            _slowQueries[_nextSlowQuery] = q;
+            _nextSlowQuery = (_nextSlowQuery + 1) % MAX_SLOW_QUERIES;
+        }
+    }
+}
+
+void QueryStats::reset()
+{
+    QMutexLocker lock(&_mutex);
+    _counters.clear();
+    _slowQueries.clear();
+    _nextSlowQuery = 0;
+}
+
+QList<QueryStats::Entry> QueryStats::entries() const
+{
+    QMutexLocker lock(&_mutex);
+
+    QList<Entry> entries;
+    entries.reserve(_counters.size());
+    for (auto it = _counters.cbegin(); it != _counters.cend(); it++)
+    {
+        const auto& c = it.value();
+        entries << Entry {
+            .sql = it.key(),
+            .count = c.count,
+            .totalNs = c.totalNs,
+            .maxNs = c.maxNs,
+            .rows = c.rows,
+            .p50Ns = percentile(c.samples, 0.5),
+            .p99Ns = percentile(c.samples, 0.99),
+        };
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.totalNs > b.totalNs; });
+    return entries;
+}
+
+QList<QueryStats::SlowQuery> QueryStats::slowQueries() const
+{
+    QMutexLocker lock(&_mutex);
+
+    QList<SlowQuery> queries;
+    queries.reserve(_slowQueries.size());
+    // Unroll the ring buffer starting from the latest item
+    for (int i = 0; i < _slowQueries.size(); i++)
+    {
+        int index = (_nextSlowQuery - 1 - i + 2*_slowQueries.size()) % _slowQueries.size();
+        queries << _slowQueries.at(index);
+    }
+    return queries;
+}
+
+QString QueryStats::report(int maxEntries) const
+{
+    QString r;
+    QTextStream res(&r);
+
+    if (!isEnabled())
+        res << "Query statistics is disabled\n\n";
+
+    auto entries = this->entries();
+    res << "Distinct queries: " << entries.size() << "\n\n";
+    for (int i = 0; i < entries.size() && i < maxEntries; i++)
+    {
+        const auto& e = entries.at(i);
+        res << e.sql.simplified() << '\n'
+            << "    count: " << e.count
+            << ", total: " << formatMs(e.totalNs) << " ms"
+            << ", p50: " << formatMs(e.p50Ns) << " ms"
+            << ", p99: " << formatMs(e.p99Ns) << " ms"
+            << ", max: " << formatMs(e.maxNs) << " ms"
+            << ", rows: " << e.rows << "\n\n";
+    }
+
+    auto slow = slowQueries();
+    res << "Slow queries (>= " << _slowThresholdMs.load() << " ms): " << slow.size() << "\n\n";
+    for (const auto& q : std::as_const(slow))
+        res << q.moment.toString(Qt::ISODateWithMs) << "  " << formatMs(q.elapsedNs) << " ms, rows: " << q.rows << '\n'
+            << "    " << q.sql.simplified() << '\n';
+
+    return r;
+}
+
+QJsonObject QueryStats::toJson() const
+{
+    QJsonArray queries;
+    for (const auto& e : entries())
+        queries.append(QJsonObject {
+            { "sql", e.sql },
+            { "count", e.count },
+            { "total_ms", e.totalNs / 1e6 },
+            { "p50_ms", e.p50Ns / 1e6 },
+            { "p99_ms", e.p99Ns / 1e6 },
+            { "max_ms", e.maxNs / 1e6 },
+            { "rows", e.rows },
+        });
+
+    QJsonArray slow;
+    for (const auto& q : slowQueries())
+        slow.append(QJsonObject {
+            { "sql", q.sql },
+            { "elapsed_ms", q.elapsedNs / 1e6 },
+            { "rows", q.rows },
+            { "moment", q.moment.toString(Qt::ISODateWithMs) },
+        });
+
+    return QJsonObject {
+        { "enabled", isEnabled() },
+        { "slow_threshold_ms", _slowThresholdMs.load() },
+        { "queries", queries },
+        { "slow_queries", slow },
+    };
+}
+
+//------------------------------------------------------------------------------
+//                                QueryProbe
+//------------------------------------------------------------------------------
+
+QueryProbe::QueryProbe(QueryProbe&& other)
+{
+    _sql = std::move(other._sql);
+    _elapsedNs = other._elapsedNs;
+    _rows = other._rows;
+    other._sql.clear();
+    other._elapsedNs = 0;
+    other._rows = 0;
+}
+
+void QueryProbe::finish()
+{
+    if (_sql.isEmpty()) return;
+    QueryStats::instance()->record(_sql, _elapsedNs, _rows);
+    _sql.clear();
+    _elapsedNs = 0;
+    _rows = 0;
+}
+
+//------------------------------------------------------------------------------
+//                               PreparedQuery
+//------------------------------------------------------------------------------
+
+PreparedQuery::PreparedQuery(const QString& sql)
+{
+    _cache = StatementCache::instance();
+    _statement = _cache->acquire(sql);
+}
+
+PreparedQuery::PreparedQuery(PreparedQuery&& other)
+{
+    _cache = other._cache;
+    _statement = other._statement;
+    other._cache = nullptr;
+    other._statement = nullptr;
+}
+
+PreparedQuery::~PreparedQuery()
+{
+    if (_cache && _statement)
+        _cache->release(_statement);
+}
+
+//------------------------------------------------------------------------------
+//                               Transactions
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Each thread uses its own connection, so the depth is per connection too
+thread_local int nestedTransactions = 0;
+
+QString savepointName(int depth)
+{
+    return QString("sp%1").arg(depth);
+}
+
+} // namespace
+
+int transactionDepth()
+{
+    return nestedTransactions;
+}
+
+QString beginTransaction()
+{
+    if (nestedTransactions == 0)
+    {
+        auto db = threadDatabase();
+        if (!db.transaction())
+            return QString("Unable to start transaction.\n\n%1").arg(SqlHelper::errorText(db.lastError()));
+    }
+    else
+    {
+        auto res = ActionQuery("SAVEPOINT " + savepointName(nestedTransactions)).exec();
+        if (!res.isEmpty())
+            return QString("Unable to start nested transaction.\n\n%1").arg(res);
+    }
+    nestedTransactions++;
+    return QString();
+}
+
+QString commitTransaction()
+{
+    if (nestedTransactions == 0)
+        return QStringLiteral("There is no transaction to commit");
+
+    nestedTransactions--;
+
+    if (nestedTransactions == 0)
+    {
+        auto db = threadDatabase();
+        if (!db.commit())
+        {
+            QString res = SqlHelper::errorText(db.lastError());
+            db.rollback();
+            return QString("Unable to commit transaction.\n\n%1").arg(res);
+        }
+    }
+    else
+    {
+        auto res = ActionQuery("RELEASE SAVEPOINT " + savepointName(nestedTransactions)).exec();
+        if (!res.isEmpty())
+        {
+            // The savepoint is still on the stack, roll it back and release
+            nestedTransactions++;
+            rollbackTransaction();
+            return QString("Unable to commit nested transaction.\n\n%1").arg(res);
+        }
+    }
+    return QString();
+}
+
+void rollbackTransaction()
+{
+    if (nestedTransactions == 0)
+        return;
+
+    nestedTransactions--;
+
+    if (nestedTransactions == 0)
+    {
+        threadDatabase().rollback();
+    }
+    else
+    {
+        // ROLLBACK TO leaves the savepoint on the stack, it has to be released too
+        auto name = savepointName(nestedTransactions);
+        auto res = ActionQuery("ROLLBACK TO SAVEPOINT " + name).exec();
+        if (res.isEmpty())
+            res = ActionQuery("RELEASE SAVEPOINT " + name).exec();
+        if (!res.isEmpty())
+            qWarning() << "Failed to rollback nested transaction" << res;
+    }
+}
+
+//------------------------------------------------------------------------------
+//                                 TableDef
+//------------------------------------------------------------------------------
+
 TableDef::~TableDef()
 {}
 
@@ -98,9 +585,14 @@ QString maybeAddConstrain(const QString& tableName, const QStringList& columns)
 
 QString maybeAddIndex(const QString& tableName, const QString& columnName)
 {
-    QString name = QString("idx_%1_%2").arg(tableName, columnName);
+    return maybeAddIndex(tableName, QStringList{columnName});
+}
+
+QString maybeAddIndex(const QString& tableName, const QStringList& columns)
+{
+    QString name = QString("idx_%1_%2").arg(tableName, columns.join('_'));
     QString sql = QString("CREATE INDEX IF NOT EXISTS %1 ON %2 (%3)")
-                      .arg(name, tableName, columnName);
+                      .arg(name, tableName, columns.join(','));
     return AnyQuery(sql).exec().error();
 }
 
@@ -4,6 +4,10 @@
 #include <QtSql>
 #include <QString>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
+
+#include <atomic>
 
 namespace SqlHelper {
 
@@ -18,38 +22,214 @@ QString errorText(const QSqlError &error);
 namespace Ori {
 namespace Sql {
 
+/// Connection used by queries running in the current thread.
+/// A connection can only be used in the thread where it was opened,
+/// so a worker thread assigns its own connection before running any queries.
+QString threadConnectionName();
+void setThreadConnectionName(const QString& connectionName);
+QSqlDatabase threadDatabase();
+
+/// Prepared statements of a database connection, keyed by SQL text.
+/// Queries having the same text reuse a statement instead of parsing it again.
+/// When the cache is full, the least recently used statement is dropped for a new one.
+class StatementCache
+{
+public:
+    struct Statement
+    {
+        QSqlQuery query;
+        bool busy = false;
+        bool cached = false;
+        quint64 lastUse = 0;
+    };
+
+    static StatementCache* instance(const QString& connectionName = threadConnectionName());
+
+    /// Finalizes all statements of the connection.
+    /// Should be called before the connection is closed.
+    static void clear(const QString& connectionName = threadConnectionName());
+
+    ~StatementCache();
+
+    Statement* acquire(const QString& sql);
+    void release(Statement* statement);
+
+    int hits() const { return _hits; }
+    int misses() const { return _misses; }
+    int size() const { return _statements.size(); }
+
+private:
+    StatementCache(const QString& connectionName) : _connectionName(connectionName) {}
+
+    QString _connectionName;
+    QHash<QString, Statement*> _statements;
+    int _hits = 0;
+    int _misses = 0;
+    quint64 _useCounter = 0;
+
+    void reset();
+    void evictLeastUsed();
+};
+
+/// Optional instrumentation of queries: per SQL text counters and latencies, and a log of slow queries.
+/// It's disabled by default, then queries only check the flag and don't read the clock.
+/// Statistics are shared by all connections, the storage thread reports here too.
+class QueryStats
+{
+public:
+    struct Entry
+    {
+        QString sql;
+        int count = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        qint64 rows = 0;
+        qint64 p50Ns = 0;
+        qint64 p99Ns = 0;
+    };
+
+    struct SlowQuery
+    {
+        QString sql;
+        qint64 elapsedNs;
+        qint64 rows;
+        QDateTime moment;
+    };
+
+    static QueryStats* instance();
+
+    static bool isEnabled() { return _enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on) { _enabled.store(on, std::memory_order_relaxed); }
+
+    int slowThresholdMs() const { return _slowThresholdMs; }
+    void setSlowThresholdMs(int ms) { _slowThresholdMs = ms; }
+
+    void record(const QString& sql, qint64 elapsedNs, qint64 rows);
+    void reset();
+
+    /// Collected statistics sorted by total time descending.
+    QList<Entry> entries() const;
+    /// Recent slow queries, the latest one is the first.
+    QList<SlowQuery> slowQueries() const;
+
+    QString report(int maxEntries = 30) const;
+    QJsonObject toJson() const;
+
+private:
+    QueryStats() {}
+
+    struct Counter
+    {
+        int count = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        qint64 rows = 0;
+        // The latest latencies for percentiles, used as a ring buffer
+        QVector<qint64> samples;
+        int nextSample = 0;
+    };
+
+    inline static std::atomic<bool> _enabled = false;
+    std::atomic<int> _slowThresholdMs = 50;
+    mutable QMutex _mutex;
+    QHash<QString, Counter> _counters;
+    QVector<SlowQuery> _slowQueries;
+    int _nextSlowQuery = 0;
+};
+
+/// Accumulates time spent in a query's exec and stepping, and number of rows,
+/// and reports them to QueryStats when the query is finished.
+class QueryProbe
+{
+public:
+    QueryProbe() {}
+    QueryProbe(QueryProbe&& other);
+    ~QueryProbe() { finish(); }
+
+    void start(const QString& sql)
+    {
+        if (!QueryStats::isEnabled()) return;
+        if (_sql.isEmpty()) _sql = sql;
+        _timer.start();
+    }
+
+    void stop(qint64 rows = 0)
+    {
+        if (!_timer.isValid()) return;
+        _elapsedNs += _timer.nsecsElapsed();
+        _rows += rows;
+        _timer.invalidate();
+    }
+
+    void finish();
+
+private:
+    QString _sql;
+    QElapsedTimer _timer;
+    qint64 _elapsedNs = 0;
+    qint64 _rows = 0;
+};
+
+/// A prepared statement borrowed from the connection's cache for the lifetime of the object.
+class PreparedQuery
+{
+public:
+    explicit PreparedQuery(const QString& sql);
+    PreparedQuery(PreparedQuery&& other);
+    ~PreparedQuery();
+
+    PreparedQuery(const PreparedQuery&) = delete;
+    PreparedQuery& operator=(const PreparedQuery&) = delete;
+
+    QSqlQuery& query() { return _statement->query; }
+    const QSqlQuery& query() const { return _statement->query; }
+
+private:
+    StatementCache* _cache = nullptr;
+    StatementCache::Statement* _statement = nullptr;
+};
+
 class ActionQuery
 {
 public:
-    ActionQuery(const QString& sql)
+    ActionQuery(const QString& sql) : _query(sql)
     {
-        _query.prepare(sql);
     }
 
     ActionQuery& param(const QString& name, const QVariant& value)
     {
-        _query.bindValue(':' + name, value);
+        _query.query().bindValue(':' + name, value);
         return *this;
     }
 
     QString exec()
     {
-        if (!_query.exec())
-            return SqlHelper::errorText(_query, true);
+        QueryProbe probe;
+        probe.start(_query.query().lastQuery());
+        bool ok = _query.query().exec();
+        probe.stop(ok ? _query.query().numRowsAffected() : 0);
+        if (!ok)
+            return SqlHelper::errorText(_query.query(), true);
         return QString();
     }
 
+    /// Id assigned by the database to the row inserted by the last execution.
+    QVariant lastInsertId() const { return _query.query().lastInsertId(); }
+
 private:
-    QSqlQuery _query;
+    PreparedQuery _query;
 };
 
 
 class SelectQuery
 {
 public:
-    SelectQuery(const QString& sql)
+    SelectQuery(const QString& sql) : _query(threadDatabase())
     {
-        if (!_query.exec(sql))
+        _probe.start(sql);
+        bool ok = _query.exec(sql);
+        _probe.stop();
+        if (!ok)
             _error = SqlHelper::errorText(_query, true);
     }
 
@@ -60,7 +240,9 @@ public:
     bool next()
     {
         if (!_query.isSelect()) return false;
+        _probe.start(_query.lastQuery());
         bool ok =  _query.isValid() ? _query.next(): _query.first();
+        _probe.stop(ok ? 1 : 0);
         if (ok) _record = _query.record();
         return ok;
     }
@@ -68,6 +250,7 @@ public:
 protected:
     QSqlQuery _query;
     QSqlRecord _record;
+    QueryProbe _probe;
 
 private:
     QString _error;
@@ -77,42 +260,48 @@ private:
 class AnyQuery
 {
 public:
-    AnyQuery(AnyQuery& other)
+    AnyQuery(AnyQuery& other) : _query(std::move(other._query)), _probe(std::move(other._probe))
     {
         // The query is not meant to be copied (because of QSqlQuery)
         // this constructor actualy takes reference to a temporary object
         // in calls like
         // auto q = AnyQuery().param().param()....exec()
-        _query = std::move(other._query);
         _error = other._error;
         _record = other._record;
     }
     
-    AnyQuery(const QString& sql)
+    AnyQuery(const QString& sql) : _query(sql)
     {
         _error = QStringLiteral("Query is not executed");
-        _query.prepare(sql);
     }
 
     AnyQuery& param(const QString& name, const QVariant& value)
     {
-        _query.bindValue(':' + name, value);
+        _query.query().bindValue(':' + name, value);
         return *this;
     }
 
     AnyQuery& exec()
     {
-        if (!_query.exec())
-            _error = SqlHelper::errorText(_query, true);
+        // The query can be executed several times with different params
+        _probe.finish();
+        _probe.start(_query.query().lastQuery());
+        bool ok = _query.query().exec();
+        _probe.stop();
+        if (!ok)
+            _error = SqlHelper::errorText(_query.query(), true);
         else _error.clear();
         return *this;
     }
 
     bool next()
     {
-        if (!_query.isSelect()) return false;
-        bool ok =  _query.isValid() ? _query.next(): _query.first();
-        if (ok) _record = _query.record();
+        auto& q = _query.query();
+        if (!q.isSelect()) return false;
+        _probe.start(q.lastQuery());
+        bool ok =  q.isValid() ? q.next(): q.first();
+        _probe.stop(ok ? 1 : 0);
+        if (ok) _record = q.record();
         return ok;
     }
 
@@ -124,8 +313,9 @@ public:
 
 private:
     QString _error;
-    QSqlQuery _query;
+    PreparedQuery _query;
     QSqlRecord _record;
+    QueryProbe _probe;
 };
 
 class TableDef
@@ -187,6 +377,16 @@ QString createTable(TableDef *table);
 QString maybeAddColumn(const QString& tableName, const QString& columnName);
 QString maybeAddConstrain(const QString& tableName, const QStringList& columns);
 QString maybeAddIndex(const QString& tableName, const QString& columnName);
+QString maybeAddIndex(const QString& tableName, const QStringList& columns);
+
+/// Begins a transaction, or a savepoint if a transaction is already started,
+/// then a store method having its own transaction can be a part of a bigger one.
+QString beginTransaction();
+QString commitTransaction();
+void rollbackTransaction();
+
+/// Number of nested transactions started in the current thread.
+int transactionDepth();
 
 } // namespace Sql
 } // namespace Ori
@@ -0,0 +1,63 @@
+#include "StorageWorker.h"
+
+#include "Enot.h"
+#include "SqlHelper.h"
+
+#include <QDebug>
+#include <QSqlDatabase>
+#include <QThread>
+#include <QUuid>
+
+StorageWorker::StorageWorker(const QString& fileName, const StorageProfile& profile)
+{
+    _connectionName = "storage_" + QUuid::createUuid().toString(QUuid::Id128);
+
+    _thread = new QThread;
+    _thread->setObjectName("StorageWorker");
+
+    // Queued calls are executed in the thread the context object lives in
+    _context = new QObject;
+    _context->moveToThread(_thread);
+    QObject::connect(_thread, &QThread::finished, _context, &QObject::deleteLater);
+
+    _thread->start();
+
+    post([name = _connectionName, fileName, profile]{
+        Ori::Sql::setThreadConnectionName(name);
+
+        auto db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(fileName);
+        if (!db.open())
+        {
+            qWarning() << "Unable to open storage connection" << SqlHelper::errorText(db.lastError());
+            return;
+        }
+
+        Ori::Sql::SelectQuery query("PRAGMA foreign_keys = ON");
+        if (query.isFailed())
+            qWarning() << "Failed to enable foreign keys for storage connection" << query.error();
+
+        auto res = Enot::applyStorageProfile(profile);
+        if (!res.isEmpty())
+            qWarning() << "Failed to configure storage connection" << res;
+    });
+}
+
+StorageWorker::~StorageWorker()
+{
+    // All jobs posted before are completed when this one returns
+    post([name = _connectionName]{
+        Ori::Sql::StatementCache::clear(name);
+        QSqlDatabase::database(name).close();
+        QSqlDatabase::removeDatabase(name);
+    }, true);
+
+    _thread->quit();
+    _thread->wait();
+    delete _thread;
+}
+
+void StorageWorker::post(std::function<void()> job, bool wait)
+{
+    QMetaObject::invokeMethod(_context, job, wait ? Qt::BlockingQueuedConnection : Qt::QueuedConnection);
+}
@@ -0,0 +1,50 @@
+#ifndef STORAGE_WORKER_H
+#define STORAGE_WORKER_H
+
+#include <QFuture>
+#include <QObject>
+#include <QPromise>
+
+#include <functional>
+#include <memory>
+
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
+struct StorageProfile;
+
+/// Runs store calls in a dedicated thread having its own connection to the notebook file.
+/// Jobs are executed one by one in the order they were posted.
+/// A job must not touch entries (they belong to the GUI thread), only ids and plain values.
+class StorageWorker
+{
+public:
+    StorageWorker(const QString& fileName, const StorageProfile& profile);
+    ~StorageWorker();
+
+    template <typename T>
+    QFuture<T> run(std::function<T()> job)
+    {
+        auto promise = std::make_shared<QPromise<T>>();
+        auto future = promise->future();
+        promise->start();
+        post([promise, job]{
+            if constexpr (std::is_void_v<T>)
+                job();
+            else
+                promise->addResult(job());
+            promise->finish();
+        });
+        return future;
+    }
+
+private:
+    QString _connectionName;
+    QThread* _thread;
+    QObject* _context;
+
+    void post(std::function<void()> job, bool wait = false);
+};
+
+#endif // STORAGE_WORKER_H
@@ -9,6 +9,7 @@
 
 #include "helpers/OriLayouts.h"
 
+#include <QScrollBar>
 #include <QStackedLayout>
 
 MarkdownMemoEditor::MarkdownMemoEditor(Memo* memo) : TextMemoEditor(memo, false)
@@ -36,7 +37,21 @@ MarkdownMemoEditor::~MarkdownMemoEditor()
 
 void MarkdownMemoEditor::showMemo()
 {
-    _view->setHtml(MarkdownHelper::markdownToHtml(_memo->data()));
+    showMarkdown(_memo->data());
+}
+
+void MarkdownMemoEditor::showMarkdown(const QString& markdown)
+{
+    // Only changed blocks are converted, and the view is not touched at all
+    // when nothing has changed, e.g. when preview is toggled without editing
+    QString html = _converter.markdownToHtml(markdown);
+    if (html == _shownHtml)
+        return;
+    _shownHtml = html;
+
+    int scrollPos = _view->verticalScrollBar()->value();
+    _view->setHtml(html);
+    _view->verticalScrollBar()->setValue(scrollPos);
 }
 
 void MarkdownMemoEditor::setFocus()
@@ -119,7 +134,7 @@ void MarkdownMemoEditor::togglePreviewMode(bool on)
     if (on)
     {
         if (_editor)
-            _view->setHtml(MarkdownHelper::markdownToHtml(_editor->toPlainText()));
+            showMarkdown(_editor->toPlainText());
         _tabs->setCurrentWidget(_view);
     }
     else
@@ -133,7 +148,8 @@ void MarkdownMemoEditor::optionChanged(AppSettingsOption option)
 {
     if (option != AppSettingsOption::MARKDOWN_CSS) return;
     _view->document()->setDefaultStyleSheet(AppSettings::instance().markdownCss());
-    _view->setHtml(MarkdownHelper::markdownToHtml(_editor ? _editor->toPlainText() : _memo->data()));
+    _shownHtml.clear();
+    showMarkdown(_editor ? _editor->toPlainText() : _memo->data());
 }
 
 void MarkdownMemoEditor::exportToPdf(const QString& fileName)
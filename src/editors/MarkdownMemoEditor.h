@@ -3,6 +3,7 @@
 
 #include "MemoEditor.h"
 #include "../AppSettings.h"
+#include "../markdown/MarkdownHelper.h"
 
 QT_BEGIN_NAMESPACE
 class QStackedLayout;
@@ -40,6 +41,10 @@ private:
     QStackedLayout* _tabs;
     QFont _memoFont;
     bool _wordWrap = false;
+    MarkdownHelper::IncrementalConverter _converter;
+    QString _shownHtml;
+
+    void showMarkdown(const QString& markdown);
 };
 
 #endif // MARKDOWN_MEMO_EDITOR_H
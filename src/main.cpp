@@ -1,6 +1,7 @@
 #include "MainWindow.h"
 
 #include "AppSettings.h"
+#include "core/SqlHelper.h"
 
 #include "helpers/OriTheme.h"
 #include "tools/OriDebug.h"
@@ -44,6 +45,9 @@ bool processCommandLine()
 
     AppSettings::instance().isDevMode = parser.isSet(optionDevMode);
 
+    // Timings of queries are viewable in the command console
+    Ori::Sql::QueryStats::setEnabled(parser.isSet(optionDevMode));
+
     return true;
 }
 
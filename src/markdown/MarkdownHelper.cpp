@@ -2,29 +2,321 @@
 
 #include "ori_html.h"
 
+#include <QMutex>
+#include <QPromise>
+#include <QRegularExpression>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
 namespace MarkdownHelper {
 
+namespace {
+
+/// Hoedown renderer and document are not changed by rendering,
+/// so they are kept and used again for the next text.
+/// The output buffer is reset before each rendering and keeps its memory.
+class Converter
+{
+public:
+    Converter()
+    {
+        hoedown_extensions extensions = hoedown_extensions(HOEDOWN_EXT_BLOCK | HOEDOWN_EXT_SPAN);
+        _renderer = hoedown_html_renderer_new_ori();
+        _document = hoedown_document_new(_renderer, extensions, 16);
+        _outBuf = hoedown_buffer_new(64);
+    }
+
+    ~Converter()
+    {
+        hoedown_buffer_free(_outBuf);
+        hoedown_document_free(_document);
+        hoedown_html_renderer_free_ori(_renderer);
+    }
+
+    QString render(const QString& markdown)
+    {
+        // Hoedown reads the UTF-8 bytes in place, no need to copy them into its own buffer
+        auto markdownBytes = markdown.toUtf8();
+        hoedown_buffer_reset(_outBuf);
+        hoedown_document_render(_document, _outBuf,
+            reinterpret_cast<const uint8_t*>(markdownBytes.constData()), static_cast<size_t>(markdownBytes.size()));
+        QString html = QString::fromUtf8(reinterpret_cast<const char*>(_outBuf->data), static_cast<qsizetype>(_outBuf->size));
+
+        // Don't keep a lot of memory in idle converters after some huge text
+        if (_outBuf->asize > MAX_KEPT_OUT_BUF)
+        {
+            hoedown_buffer_free(_outBuf);
+            _outBuf = hoedown_buffer_new(64);
+        }
+        return html;
+    }
+
+private:
+    static constexpr size_t MAX_KEPT_OUT_BUF = 1024 * 1024;
+
+    hoedown_renderer* _renderer;
+    hoedown_document* _document;
+    hoedown_buffer* _outBuf;
+};
+
+/// Converters are not thread-safe, each thread takes its own one from the pool
+/// and returns it back when done, then the pool has as many converters
+/// as there were threads converting at the same time.
+class ConverterPool
+{
+public:
+    ~ConverterPool()
+    {
+        qDeleteAll(_converters);
+    }
+
+    Converter* take()
+    {
+        {
+            QMutexLocker lock(&_mutex);
+            if (!_converters.isEmpty())
+                return _converters.takeLast();
+        }
+        return new Converter;
+    }
+
+    void give(Converter* converter)
+    {
+        QMutexLocker lock(&_mutex);
+        _converters << converter;
+    }
+
+private:
+    QMutex _mutex;
+    QList<Converter*> _converters;
+};
+
+ConverterPool& converterPool()
+{
+    static ConverterPool pool;
+    return pool;
+}
+
+struct PooledConverter
+{
+    PooledConverter() : converter(converterPool().take()) {}
+    ~PooledConverter() { converterPool().give(converter); }
+    Converter* operator->() const { return converter; }
+    Converter* converter;
+};
+
+} // namespace
+
+static QString renderBody(const QString& markdown)
+{
+    return PooledConverter()->render(markdown);
+}
+
+static QString wrapBody(const QString& body)
+{
+    return QStringLiteral("<html></body>\n") + body + QStringLiteral("\n</body></html>");
+}
+
 QString markdownToHtml(const QString& markdown)
 {
-    auto markdownBytes = markdown.toUtf8();
+    return wrapBody(renderBody(markdown));
+}
 
-    hoedown_extensions extensions = hoedown_extensions(HOEDOWN_EXT_BLOCK | HOEDOWN_EXT_SPAN);
-    hoedown_renderer* renderer = hoedown_html_renderer_new_ori();
-    hoedown_document* document = hoedown_document_new(renderer, extensions, 16);
-    hoedown_buffer* in_buf = hoedown_buffer_new(1024);
-    hoedown_buffer_set(in_buf, reinterpret_cast<const uint8_t*>(markdownBytes.data()), static_cast<size_t>(markdownBytes.size()));
-    hoedown_buffer* out_buf = hoedown_buffer_new(64);
-    hoedown_document_render(document, out_buf, in_buf->data, in_buf->size);
-    hoedown_buffer_free(in_buf);
-    hoedown_document_free(document);
-    hoedown_html_renderer_free_ori(renderer);
+QStringList markdownToHtmlBatch(const QStringList& markdowns)
+{
+    PooledConverter converter;
+    QStringList htmls;
+    htmls.reserve(markdowns.size());
+    for (const auto& markdown : markdowns)
+        htmls << wrapBody(converter->render(markdown));
+    return htmls;
+}
 
-    QByteArray htmlBytes(reinterpret_cast<char*>(out_buf->data), static_cast<int>(out_buf->size));
-    QString html = QStringLiteral("<html></body>\n") + QString::fromUtf8(htmlBytes) + QStringLiteral("\n</body></html>");
+QFuture<QStringList> markdownToHtmlParallel(const QStringList& markdowns)
+{
+    struct Job
+    {
+        QPromise<QStringList> promise;
+        QStringList markdowns;
+        std::vector<QString> htmls;
+        std::atomic<qsizetype> nextIndex = 0;
+        std::atomic<int> runningTasks = 0;
+    };
+    auto job = std::make_shared<Job>();
+    job->markdowns = markdowns;
+    job->htmls.resize(markdowns.size());
+    job->promise.start();
+    auto future = job->promise.future();
 
-    hoedown_buffer_free(out_buf);
+    if (markdowns.isEmpty())
+    {
+        job->promise.addResult(QStringList());
+        job->promise.finish();
+        return future;
+    }
 
-    return html;
+    // Each task takes the next unconverted text until there are no more,
+    // so long and short texts are spread between threads evenly.
+    // Every html is written into its own slot, then the last finished task
+    // assembles them in the original order.
+    auto pool = QThreadPool::globalInstance();
+    int taskCount = static_cast<int>(qMin(markdowns.size(), qsizetype(qMax(1, pool->maxThreadCount()))));
+    job->runningTasks = taskCount;
+    for (int t = 0; t < taskCount; t++)
+    {
+        pool->start([job]{
+            PooledConverter converter;
+            const qsizetype count = job->markdowns.size();
+            for (qsizetype i = job->nextIndex++; i < count; i = job->nextIndex++)
+                job->htmls[i] = wrapBody(converter->render(job->markdowns.at(i)));
+
+            if (--job->runningTasks > 0)
+                return;
+            QStringList htmls;
+            htmls.reserve(count);
+            for (auto& html : job->htmls)
+                htmls << std::move(html);
+            job->promise.addResult(htmls);
+            job->promise.finish();
+        });
+    }
+    return future;
+}
+
+static bool isBlank(const QString& line)
+{
+    for (auto ch : line)
+        if (!ch.isSpace())
+            return false;
+    return true;
+}
+
+static bool isIndented(const QString& line)
+{
+    return !line.isEmpty() && (line.at(0) == ' ' || line.at(0) == '\t');
+}
+
+static bool isQuote(const QString& line)
+{
+    static QRegularExpression re("^\\s{0,3}>");
+    return re.match(line).hasMatch();
+}
+
+static bool isListItem(const QString& line)
+{
+    static QRegularExpression re("^\\s{0,3}([-*+]|\\d+\\.)\\s");
+    return re.match(line).hasMatch();
+}
+
+// Returns fence characters if the line opens or closes a fenced code block
+static QString codeFence(const QString& line)
+{
+    static QRegularExpression re("^\\s{0,3}(`{3,}|~{3,})");
+    auto m = re.match(line);
+    return m.hasMatch() ? m.captured(1) : QString();
+}
+
+QStringList splitBlocks(const QString& markdown)
+{
+    static QRegularExpression refDef("^\\s{0,3}\\[[^\\]]+\\]:", QRegularExpression::MultilineOption);
+    if (markdown.contains(refDef))
+        return {markdown};
+
+    // Raw html blocks can contain blank lines and are only closed by their end tag
+    static QRegularExpression htmlBlock("^<(!--|/?(p|dl|div|math|table|ul|del|form|blockquote|figure|ol|"
+        "fieldset|h[1-6]|pre|script|style|iframe|ins|noscript|hr)\\b)",
+        QRegularExpression::MultilineOption | QRegularExpression::CaseInsensitiveOption);
+    if (markdown.contains(htmlBlock))
+        return {markdown};
+
+    QStringList blocks;
+    QStringList lines;
+    QString fence;
+    bool prevIsList = false;
+    bool prevIsQuote = false;
+    bool blankSeen = false;
+
+    auto flush = [&]{
+        if (!lines.isEmpty())
+            blocks << lines.join('\n');
+        lines.clear();
+    };
+
+    for (const auto& line : markdown.split('\n'))
+    {
+        if (!fence.isEmpty())
+        {
+            lines << line;
+            auto f = codeFence(line);
+            if (!f.isEmpty() && f.at(0) == fence.at(0) && f.size() >= fence.size())
+                fence.clear();
+            continue;
+        }
+
+        if (isBlank(line))
+        {
+            if (!lines.isEmpty())
+                blankSeen = true;
+            continue;
+        }
+
+        if (blankSeen)
+        {
+            // Indented lines continue list items or code blocks,
+            // list items separated by blank lines still make a single list,
+            // and so do quoted lines for a blockquote
+            bool continues = isIndented(line) ||
+                (prevIsList && isListItem(line)) || (prevIsQuote && isQuote(line));
+            if (continues)
+                lines << QString();
+            else
+            {
+                flush();
+                prevIsList = isListItem(line);
+                prevIsQuote = isQuote(line);
+            }
+            blankSeen = false;
+        }
+        else if (lines.isEmpty())
+        {
+            prevIsList = isListItem(line);
+            prevIsQuote = isQuote(line);
+        }
+
+        lines << line;
+        fence = codeFence(line);
+    }
+    flush();
+
+    return blocks;
+}
+
+QString IncrementalConverter::markdownToHtml(const QString& markdown)
+{
+    PooledConverter converter;
+    QHash<QString, QString> blocks;
+    QString body;
+    _convertedCount = 0;
+    for (const auto& block : splitBlocks(markdown))
+    {
+        QString html;
+        auto it = _blocks.constFind(block);
+        if (it != _blocks.cend())
+            html = it.value();
+        else
+        {
+            html = converter->render(block);
+            _convertedCount++;
+        }
+        body += html;
+        blocks.insert(block, html);
+    }
+    // Only blocks of the last text are kept
+    _blocks = blocks;
+    return wrapBody(body);
 }
 
 } // namespace MarkdownHelper
@@ -1,12 +1,45 @@
 #ifndef MARKDOWN_HELPER_H
 #define MARKDOWN_HELPER_H
 
-#include <QString>
+#include <QFuture>
+#include <QHash>
+#include <QStringList>
 
 namespace MarkdownHelper {
 
 QString markdownToHtml(const QString& markdown);
 
+/// Converts several texts at once, it's cheaper than converting them one by one.
+/// Can be called from any thread.
+QStringList markdownToHtmlBatch(const QStringList& markdowns);
+
+/// Converts texts in the global thread pool, several texts are converted at the same time.
+/// Htmls in the result go in the same order as the texts.
+QFuture<QStringList> markdownToHtmlParallel(const QStringList& markdowns);
+
+/// Splits markdown into top-level blocks which can be converted into html independently.
+/// Returns the whole text as a single block if it contains reference links or footnotes,
+/// they can't be resolved when their definitions are in other blocks.
+/// The same is for raw html blocks, they can have blank lines inside.
+QStringList splitBlocks(const QString& markdown);
+
+/**
+    Converts markdown into html block by block and remembers html of each block.
+    When a slightly changed text is converted again, only changed blocks are converted.
+*/
+class IncrementalConverter
+{
+public:
+    QString markdownToHtml(const QString& markdown);
+
+    /// Number of blocks actually converted in the last call.
+    int convertedCount() const { return _convertedCount; }
+
+private:
+    QHash<QString, QString> _blocks;
+    int _convertedCount = 0;
+};
+
 } // namespace MarkdownHelper
 
 #endif // MARKDOWN_HELPER_H
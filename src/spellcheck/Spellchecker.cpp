@@ -12,12 +12,19 @@
 #include <QFileInfo>
 #include <QMenu>
 #include <QRegularExpression>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
 #if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
 #include <QTextCodec>
 #endif
 
+#include "../AppSettings.h"
+
 #include "tools/OriSettings.h"
 
+#include <unordered_map>
+
 QMap<QString, QString> langNamesMap();
 
 //------------------------------------------------------------------------------
@@ -63,6 +70,14 @@ static QString userDictionaryPath(const QString& lang)
     return dictFile.absoluteFilePath();
 }
 
+static QString cacheFilePath(const QString& lang)
+{
+    QSharedPointer<QSettings> s(Ori::Settings::open());
+    QDir dictDir = QFileInfo(s->fileName()).absoluteDir();
+    QFileInfo cacheFile(dictDir, "spellcache-" + lang + ".txt");
+    return cacheFile.absoluteFilePath();
+}
+
 // detect encoding analyzing the SET option in the affix file
 static QString dictionaryEncoding(const QString& affixFilePath)
 {
@@ -140,12 +155,31 @@ private:
 #endif
 };
 
+QThreadPool* Spellchecker::threadPool()
+{
+    static QThreadPool* pool = nullptr;
+    if (!pool)
+    {
+        pool = new QThreadPool(qApp);
+        // Each thread loads its own copy of dictionary, don't make too many of them
+        pool->setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+        // and don't drop them too often, loading of a dictionary is not fast
+        pool->setExpiryTimeout(5 * 60 * 1000);
+    }
+    return pool;
+}
+
+static QMap<QString, Spellchecker*> checkers;
+
+QList<Spellchecker*> Spellchecker::loaded()
+{
+    return checkers.values();
+}
+
 Spellchecker* Spellchecker::get(const QString& lang)
 {
     if (lang.isEmpty()) return nullptr;
 
-    static QMap<QString, Spellchecker*> checkers;
-
     if (!checkers.contains(lang))
     {
         QDir dictDir = dictionaryDir();
@@ -175,6 +209,13 @@ Spellchecker* Spellchecker::get(const QString& lang)
 
         checker->_lang = lang;
         checkers.insert(lang, checker);
+
+        if (AppSettings::instance().spellcheckPersistCache && checker->_cacheShardCapacity > 0)
+        {
+            checker->_cacheFilePath = cacheFilePath(lang);
+            checker->loadCache();
+            connect(qApp, &QCoreApplication::aboutToQuit, checker, &Spellchecker::saveCache);
+        }
     }
 
     return checkers[lang];
@@ -183,6 +224,8 @@ Spellchecker* Spellchecker::get(const QString& lang)
 Spellchecker::Spellchecker(const QString &dictFilePath, const QString& affixFilePath, const QString &userDictionaryPath)
 {
     _userDictionaryPath = userDictionaryPath;
+    _dictFilePath = dictFilePath;
+    _affixFilePath = affixFilePath;
 
     QString encoding = dictionaryEncoding(affixFilePath);
     if (encoding.isEmpty())
@@ -200,11 +243,15 @@ Spellchecker::Spellchecker(const QString &dictFilePath, const QString& affixFile
                    << "Spellcheck is unavailable";
         return;
     }
+    _encoding = encoding;
 
     _hunspell = new Hunspell(affixFilePath.toLocal8Bit().constData(),
                              dictFilePath.toLocal8Bit().constData());
 
     loadUserDictionary();
+    _userWordsCount = _addedWords.size();
+
+    _cacheShardCapacity = qMax(0, AppSettings::instance().spellcheckCacheSize) / CACHE_SHARDS;
 }
 
 Spellchecker::~Spellchecker()
@@ -215,19 +262,214 @@ Spellchecker::~Spellchecker()
 
 bool Spellchecker::check(const QString &word) const
 {
-    return _hunspell->spell(_codec->fromUnicode(word));
+    auto cached = cachedVerdict(word);
+    if (cached)
+        return *cached;
+
+    int epoch = _cacheEpoch;
+    bool verdict = _hunspell->spell(_codec->fromUnicode(word));
+    cacheVerdict(word, verdict, epoch);
+    return verdict;
+}
+
+namespace {
+struct ThreadHunspell
+{
+    std::unique_ptr<Hunspell> hunspell;
+    std::unique_ptr<TextCodec> codec;
+    int addedCount = 0;
+};
+}
+
+static thread_local std::unordered_map<const Spellchecker*, ThreadHunspell> threadHunspells;
+
+bool Spellchecker::checkInThread(const QString &word) const
+{
+    auto cached = cachedVerdict(word);
+    if (cached)
+        return *cached;
+
+    int epoch = _cacheEpoch;
+    auto& h = threadHunspells[this];
+    if (!h.hunspell)
+    {
+        h.codec.reset(TextCodec::create(_encoding));
+        h.hunspell = std::make_unique<Hunspell>(_affixFilePath.toLocal8Bit().constData(),
+                                                _dictFilePath.toLocal8Bit().constData());
+    }
+    if (h.addedCount < _addedCount)
+    {
+        QMutexLocker lock(&_addedWordsMutex);
+        for (; h.addedCount < _addedWords.size(); h.addedCount++)
+            h.hunspell->add(h.codec->fromUnicode(_addedWords.at(h.addedCount)));
+    }
+    bool verdict = h.hunspell->spell(h.codec->fromUnicode(word));
+    cacheVerdict(word, verdict, epoch);
+    return verdict;
 }
 
 void Spellchecker::ignore(const QString &word)
 {
-    _hunspell->add(_codec->fromUnicode(word));
+    addWord(word);
     emit wordIgnored(word);
 }
 
+void Spellchecker::addWord(const QString &word)
+{
+    _hunspell->add(_codec->fromUnicode(word));
+
+    {
+        QMutexLocker lock(&_addedWordsMutex);
+        _addedWords << word;
+        _addedCount = _addedWords.size();
+    }
+
+    clearCache();
+}
+
+std::optional<bool> Spellchecker::cachedVerdict(const QString &word) const
+{
+    if (_cacheShardCapacity <= 0)
+        return {};
+
+    auto& shard = _cache[qHash(word) % CACHE_SHARDS];
+    QMutexLocker lock(&shard.mutex);
+    auto it = shard.verdicts.constFind(word);
+    if (it == shard.verdicts.cend())
+    {
+        _cacheMisses++;
+        return {};
+    }
+    _cacheHits++;
+    return it.value();
+}
+
+void Spellchecker::cacheVerdict(const QString &word, bool verdict, int epoch) const
+{
+    if (_cacheShardCapacity <= 0)
+        return;
+
+    auto& shard = _cache[qHash(word) % CACHE_SHARDS];
+    QMutexLocker lock(&shard.mutex);
+    if (epoch != _cacheEpoch)
+        return;
+    if (shard.verdicts.size() >= _cacheShardCapacity)
+    {
+        // Drop a quarter of words, order of hash items is arbitrary enough for that
+        auto it = shard.verdicts.begin();
+        while (it != shard.verdicts.end() && shard.verdicts.size() > _cacheShardCapacity * 3 / 4)
+            it = shard.verdicts.erase(it);
+    }
+    shard.verdicts.insert(word, verdict);
+}
+
+void Spellchecker::clearCache()
+{
+    _cacheEpoch++;
+    for (auto& shard : _cache)
+    {
+        QMutexLocker lock(&shard.mutex);
+        shard.verdicts.clear();
+    }
+}
+
+Spellchecker::CacheStats Spellchecker::cacheStats() const
+{
+    int size = 0;
+    for (auto& shard : _cache)
+    {
+        QMutexLocker lock(&shard.mutex);
+        size += shard.verdicts.size();
+    }
+    return {
+        .hits = _cacheHits,
+        .misses = _cacheMisses,
+        .size = size,
+        .capacity = _cacheShardCapacity * CACHE_SHARDS,
+    };
+}
+
+// The cache is valid only for the same dictionary files
+QString Spellchecker::cacheFileHeader() const
+{
+    QStringList parts;
+    for (const auto& path : {_dictFilePath, _affixFilePath, _userDictionaryPath})
+    {
+        QFileInfo info(path);
+        parts << QString::number(info.exists() ? info.size() : 0)
+              << QString::number(info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0);
+    }
+    return '#' + parts.join(' ');
+}
+
+void Spellchecker::loadCache()
+{
+    QFile file(_cacheFilePath);
+    if (!file.exists()) return;
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Unable to open spellcheck cache file for reading"
+                   << _cacheFilePath << file.errorString();
+        return;
+    }
+
+    QTextStream stream(&file);
+#if (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
+    stream.setEncoding(QStringConverter::Utf8);
+#else
+    stream.setCodec("UTF-8");
+#endif
+    if (stream.readLine() != cacheFileHeader())
+        return;
+
+    int epoch = _cacheEpoch;
+    for (QString line = stream.readLine(); line.size() > 1; line = stream.readLine())
+        cacheVerdict(line.mid(1), line.at(0) == '+', epoch);
+}
+
+void Spellchecker::saveCache() const
+{
+    if (_cacheFilePath.isEmpty()) return;
+
+    QFile file(_cacheFilePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Unable to open spellcheck cache file for writing"
+                   << _cacheFilePath << file.errorString();
+        return;
+    }
+
+    // Words ignored in this session are not valid in the next one
+    QSet<QString> sessionWords;
+    {
+        QMutexLocker lock(&_addedWordsMutex);
+        for (int i = _userWordsCount; i < _addedWords.size(); i++)
+            sessionWords << _addedWords.at(i);
+    }
+
+    QTextStream stream(&file);
+#if (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
+    stream.setEncoding(QStringConverter::Utf8);
+#else
+    stream.setCodec("UTF-8");
+#endif
+    stream << cacheFileHeader() << "\n";
+    for (auto& shard : _cache)
+    {
+        QMutexLocker lock(&shard.mutex);
+        for (auto it = shard.verdicts.cbegin(); it != shard.verdicts.cend(); it++)
+            if (!sessionWords.contains(it.key()))
+                stream << (it.value() ? '+' : '-') << it.key() << "\n";
+    }
+    file.close();
+}
+
 void Spellchecker::save(const QString &word)
 {
     if (_userDictionaryPath.isEmpty()) return;
 
+    clearCache();
+
     QFile file(_userDictionaryPath);
     if (!file.open(QIODevice::Append))
     {
@@ -274,7 +516,7 @@ void Spellchecker::loadUserDictionary()
     stream.setCodec("UTF-8");
 #endif
     for (QString word = stream.readLine(); !word.isEmpty(); word = stream.readLine())
-        _hunspell->add(_codec->fromUnicode(word));
+        addWord(word);
     file.close();
 }
 
@@ -3,12 +3,19 @@
 
 #ifdef ENABLE_SPELLCHECK
 
+#include <QHash>
+#include <QMutex>
 #include <QObject>
 
+#include <array>
+#include <atomic>
+#include <optional>
+
 QT_BEGIN_NAMESPACE
 class QAction;
 class QActionGroup;
 class QMenu;
+class QThreadPool;
 class QWidget;
 QT_END_NAMESPACE
 
@@ -21,15 +28,32 @@ class Spellchecker : public QObject
 
 public:
     static Spellchecker* get(const QString& lang);
+    static QList<Spellchecker*> loaded();
+
+    /// Threads for checking texts in background.
+    static QThreadPool* threadPool();
 
     ~Spellchecker();
 
     const QString& lang() const { return _lang; }
     bool check(const QString &word) const;
+    /// The same as check() but for worker threads.
+    /// Hunspell is not thread-safe, so each thread gets its own instance.
+    bool checkInThread(const QString &word) const;
     void ignore(const QString &word);
     void save(const QString &word);
     QStringList suggest(const QString &word) const;
 
+    struct CacheStats
+    {
+        qint64 hits;
+        qint64 misses;
+        int size;
+        int capacity;
+    };
+    CacheStats cacheStats() const;
+    void saveCache() const;
+
 signals:
     void wordIgnored(const QString& word);
 
@@ -38,9 +62,41 @@ private:
 
     QString _lang;
     QString _userDictionaryPath;
+    QString _dictFilePath, _affixFilePath, _encoding;
     Hunspell* _hunspell = nullptr;
     TextCodec*  _codec = nullptr;
 
+    // Words from the user dictionary and ignored ones,
+    // thread instances of Hunspell get them when they check the next word
+    QStringList _addedWords;
+    std::atomic<int> _addedCount = 0;
+    mutable QMutex _addedWordsMutex;
+
+    // Verdicts of checked words, split into several parts
+    // to not lock the whole cache when checking in many threads
+    struct CacheShard
+    {
+        QMutex mutex;
+        QHash<QString, bool> verdicts;
+    };
+    static constexpr int CACHE_SHARDS = 16;
+    mutable std::array<CacheShard, CACHE_SHARDS> _cache;
+    int _cacheShardCapacity = 0;
+    // Verdicts obtained before the cache was cleared are not stored
+    std::atomic<int> _cacheEpoch = 0;
+    mutable std::atomic<qint64> _cacheHits = 0;
+    mutable std::atomic<qint64> _cacheMisses = 0;
+    QString _cacheFilePath;
+    // Words loaded from the user dictionary, the rest of added ones are ignored in this session only
+    int _userWordsCount = 0;
+
+    void addWord(const QString &word);
+    std::optional<bool> cachedVerdict(const QString &word) const;
+    void cacheVerdict(const QString &word, bool verdict, int epoch) const;
+    void clearCache();
+    void loadCache();
+    QString cacheFileHeader() const;
+
     void loadUserDictionary();
 };
 
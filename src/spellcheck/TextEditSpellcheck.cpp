@@ -8,10 +8,43 @@
 #include <QAction>
 #include <QDebug>
 #include <QMenu>
+#include <QPromise>
+#include <QTextBlock>
+#include <QTextBoundaryFinder>
+#include <QTextLayout>
+#include <QThreadPool>
 #include <QTimer>
 
 using This = TextEditSpellcheck;
 
+// Approximate number of characters checked by one job in the thread pool
+static const int JOB_SIZE = 16 * 1024;
+
+// Thread pool starts jobs with higher priority first.
+// Edited blocks go before visible ones, the user waits for marks where they type
+static const int PRIORITY_HIDDEN = 0;
+static const int PRIORITY_VISIBLE = 1;
+static const int PRIORITY_CHANGES = 2;
+
+struct TextEditSpellcheck::BlockText
+{
+    int number;
+    int revision;
+    int length;
+    QString text;
+    // Positions and lengths of hyperlinks in the block, they are not checked
+    QList<QPair<int, int>> links;
+};
+
+struct TextEditSpellcheck::BlockErrors
+{
+    int number;
+    int revision;
+    int length;
+    // Positions and lengths of misspelled words in the block
+    QList<QPair<int, int>> words;
+};
+
 TextEditSpellcheck::TextEditSpellcheck(QTextEdit *editor, Spellchecker *spellchecker, QObject *parent)
     : QObject(parent), _editor(editor), _spellchecker(spellchecker)
 {
@@ -20,7 +53,8 @@ TextEditSpellcheck::TextEditSpellcheck(QTextEdit *editor, Spellchecker *spellche
     _editor->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(_editor, &QTextEdit::customContextMenuRequested, this, &This::contextMenuRequested);
     connect(_editor->document(), QOverload<int, int, int>::of(&QTextDocument::contentsChange), this, &This::documentChanged);
-    connect(_editor, &QTextEdit::cursorPositionChanged, this, &This::cursorMoved);
+
+    _currentGeneration = std::make_shared<std::atomic<int>>(_generation);
 
     _timer = new QTimer(this);
     _timer->setInterval(500);
@@ -29,6 +63,9 @@ TextEditSpellcheck::TextEditSpellcheck(QTextEdit *editor, Spellchecker *spellche
 
 TextEditSpellcheck::~TextEditSpellcheck()
 {
+    // Stop checking of remaining blocks
+    *_currentGeneration = -1;
+
     // When program closes we don't know what object is deleted first.
     // This is the only dangerous case we use QPointer for.
     if (_editor)
@@ -37,96 +74,202 @@ TextEditSpellcheck::~TextEditSpellcheck()
 
 void TextEditSpellcheck::spellcheckAll()
 {
-    _spellcheckStart = -1;
-    _spellcheckStop = -1;
-    spellcheck();
-    _editor->setExtraSelections(_errorMarks);
+    _generation++;
+    *_currentGeneration = _generation;
+
+    auto doc = _editor->document();
+    auto viewport = _editor->viewport();
+    auto firstVisible = _editor->cursorForPosition(QPoint(0, 0)).block();
+    auto lastVisible = _editor->cursorForPosition(QPoint(viewport->width()-1, viewport->height()-1)).block();
+
+    spellcheckBlocks(firstVisible, lastVisible, PRIORITY_VISIBLE);
+    if (lastVisible.next().isValid())
+        spellcheckBlocks(lastVisible.next(), doc->lastBlock(), PRIORITY_HIDDEN);
+    if (firstVisible != doc->firstBlock())
+        spellcheckBlocks(doc->firstBlock(), firstVisible.previous(), PRIORITY_HIDDEN);
 }
 
-static int selectWord(QTextCursor& cursor)
+TextEditSpellcheck::BlockText TextEditSpellcheck::takeBlockText(const QTextBlock& block)
 {
-    // When move cursor to EndOfWord, it stops before bracket, qoute, or punctuation.
-    // But quotes like &raquo; or &rdquo; become a part of the world for some reason.
-    // Remove such punctuation at word boundaries.
-
-    QString word = cursor.selectedText();
-    int length = word.length();
-    int start = 0;
-    int stop = length - 1;
+    BlockText b {
+        .number = block.blockNumber(),
+        .revision = block.revision(),
+        .length = block.length(),
+        .text = block.text(),
+    };
+    // Hyperlinks are highlighted via additional formats of the layout
+    if (auto layout = block.layout(); layout)
+        for (const auto& format : layout->formats())
+            if (format.format.isAnchor() && !format.format.anchorHref().isEmpty())
+                b.links << qMakePair(format.start, format.length);
+    return b;
+}
 
-    while (start < length)
+void TextEditSpellcheck::spellcheckBlocks(const QTextBlock& first, const QTextBlock& last, int priority)
+{
+    QList<BlockText> blocks;
+    int size = 0;
+    for (auto block = first; block.isValid(); block = block.next())
     {
-        auto ch = word.at(start);
-        if (ch.isLetter() || ch.isDigit()) break;
-        start++;
+        blocks << takeBlockText(block);
+        size += block.length();
+        if (size >= JOB_SIZE)
+        {
+            postBlocks(blocks, priority);
+            blocks.clear();
+            size = 0;
+        }
+        if (block == last)
+            break;
     }
+    if (!blocks.isEmpty())
+        postBlocks(blocks, priority);
+}
+
+static bool isWordChar(QChar ch)
+{
+    return ch.isLetter() || ch.isDigit();
+}
 
-    while (stop > start)
+QList<QPair<int, int>> TextEditSpellcheck::findErrors(Spellchecker* checker, const BlockText& block)
+{
+    QList<QPair<int, int>> errors;
+    const auto& text = block.text;
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Word, text);
+    int start = 0;
+    while (start < text.size())
     {
-        auto ch = word.at(stop);
-        if (ch.isLetter() || ch.isDigit()) break;
-        stop--;
+        int stop = finder.toNextBoundary();
+        if (stop < 0) stop = text.size();
+
+        // Word boundaries can include brackets, quotes, or punctuation, skip them
+        int wordStart = start;
+        int wordStop = stop;
+        while (wordStart < wordStop && !isWordChar(text.at(wordStart)))
+            wordStart++;
+        while (wordStop > wordStart && !isWordChar(text.at(wordStop-1)))
+            wordStop--;
+        start = stop;
+
+        // Skip one-letter words
+        //
+        // TODO: abbreviations such as "т.д." are splitted to series of one-letter words
+        // and therefore skipped, while "e.g." is taken as a whole and can be marked.
+        //
+        int length = wordStop - wordStart;
+        if (length < 2)
+            continue;
+
+        bool inLink = false;
+        for (const auto& link : block.links)
+            if (wordStart >= link.first && wordStart < link.first + link.second)
+            {
+                inLink = true;
+                break;
+            }
+        if (inLink)
+            continue;
+
+        if (!checker->checkInThread(text.mid(wordStart, length)))
+            errors << qMakePair(wordStart, length);
     }
+    return errors;
+}
 
-    length = stop - start + 1;
-    int anchor = cursor.anchor();
-    cursor.setPosition(anchor + start, QTextCursor::MoveAnchor);
-    cursor.setPosition(anchor + start + length, QTextCursor::KeepAnchor);
-    return length;
+void TextEditSpellcheck::postBlocks(const QList<BlockText>& blocks, int priority)
+{
+    auto checker = _spellchecker;
+    auto currentGeneration = _currentGeneration;
+    int generation = _generation;
+
+    auto promise = std::make_shared<QPromise<QList<BlockErrors>>>();
+    auto future = promise->future();
+    promise->start();
+    Spellchecker::threadPool()->start([promise, checker, currentGeneration, generation, blocks]{
+        QList<BlockErrors> errors;
+        errors.reserve(blocks.size());
+        for (const auto& block : blocks)
+        {
+            // The editor is closed or a new full check is started
+            if (*currentGeneration != generation)
+                break;
+            errors << BlockErrors {
+                .number = block.number,
+                .revision = block.revision,
+                .length = block.length,
+                .words = findErrors(checker, block),
+            };
+        }
+        promise->addResult(errors);
+        promise->finish();
+    }, priority);
+
+    future.then(this, [this, generation](const QList<BlockErrors>& errors){
+        if (generation == _generation)
+            applyErrors(errors);
+    });
 }
 
-void TextEditSpellcheck::spellcheck()
+void TextEditSpellcheck::applyErrors(const QList<BlockErrors>& errors)
 {
     static auto spellErrorFormat = TextFormat().spellError().get();
 
-    _errorMarks.clear();
-
-    QTextCursor cursor(_editor->document());
+    auto doc = _editor->document();
 
-    if (_spellcheckStart > -1) cursor.setPosition(_spellcheckStart);
+    // Document ranges [start, stop) of checked blocks
+    QList<QPair<int, int>> checked;
+    QList<QTextEdit::ExtraSelection> newMarks;
+    QList<BlockText> changed;
 
-    while ((_spellcheckStop < 0 || cursor.position() < _spellcheckStop) && !cursor.atEnd())
+    for (const auto& res : errors)
     {
-        cursor.movePosition(QTextCursor::EndOfWord, QTextCursor::KeepAnchor);
-        int length = selectWord(cursor);
-
-        // When we've skipped punctuation and there is no word,
-        // the cursor may be at the beginning of the next word already.
-        // For example, have text "(word1) word2",
-        // the bracket "(" is treated by QTextEdit as a separate word.
-        // After skipping it, we become at the "w" of "word1" - at the next word after the bracket!
-        // Then moving to `NextWord` shifts the cursor to "word2", and "word1" gets missed.
-        // To avoid, try to find the end of a (possible current) word after skipping punctuation.
-        if (length == 0)
+        auto block = doc->findBlockByNumber(res.number);
+        if (!block.isValid())
+            continue;
+
+        // The block has been edited or moved while it was being checked,
+        // check again whatever is at its place now
+        if (block.revision() != res.revision || block.length() != res.length)
         {
-            cursor.movePosition(QTextCursor::EndOfWord, QTextCursor::KeepAnchor);
-            length = selectWord(cursor);
+            changed << takeBlockText(block);
+            continue;
         }
 
-        // Skip one-letter words
-        //
-        // TODO: currently, abbreviations such as "e.i.", "e.g.", "т.д.", "т.п."
-        // are splitted to series of one-letter words and therefore skipped.
-        // It allows mixing of such words in different languages,
-        // e.g. one can use "т.д." in a text in English, it's not ok.
-        //
-        // Similar issue with words like "doesn't" - it splitted into "doesn" and "t",
-        // "t" is skipped and "doesn" gives spelling error. Checking is ok when
-        // true apostrophe character is used (’ = U+2019). But it's not the case
-        // when one type memos via keyboard - single quote is generally used as apostrophe.
-        //
-        // It'd be better to check such words as a whole.
-        //
-        if (length > 1 && TextEditHelpers::hyperlinkAt(cursor).isEmpty())
+        int pos = block.position();
+        checked << qMakePair(pos, pos + block.length());
+        for (const auto& word : res.words)
         {
-            QString word = cursor.selectedText();
-
-            if (!_spellchecker->check(word))
-                _errorMarks << QTextEdit::ExtraSelection {cursor, spellErrorFormat};
+            QTextCursor cursor(block);
+            cursor.setPosition(pos + word.first);
+            cursor.setPosition(pos + word.first + word.second, QTextCursor::KeepAnchor);
+            newMarks << QTextEdit::ExtraSelection {cursor, spellErrorFormat};
         }
+    }
 
-        cursor.movePosition(QTextCursor::NextWord, QTextCursor::MoveAnchor);
+    if (!checked.isEmpty())
+    {
+        std::sort(checked.begin(), checked.end());
+
+        // Marks in checked blocks are replaced with new ones
+        QList<QTextEdit::ExtraSelection> marks;
+        for (const auto& es : _editor->extraSelections())
+        {
+            // The marked word has been removed
+            if (!es.cursor.hasSelection())
+                continue;
+            int p = es.cursor.selectionStart();
+            auto it = std::upper_bound(checked.cbegin(), checked.cend(), p,
+                [](int pos, const QPair<int, int>& range){ return pos < range.first; });
+            if (it != checked.cbegin() && p < (it-1)->second)
+                continue;
+            marks << es;
+        }
+        marks.append(newMarks);
+        _editor->setExtraSelections(marks);
     }
+
+    if (!changed.isEmpty())
+        postBlocks(changed, PRIORITY_CHANGES);
 }
 
 QTextCursor TextEditSpellcheck::spellingAt(const QPoint& pos) const
@@ -196,15 +339,6 @@ void TextEditSpellcheck::addSpellcheckActions(QMenu* menu, QTextCursor& cursor)
     menu->insertActions(menu->actions().first(), actions);
 }
 
-void TextEditSpellcheck::removeErrorMark(const QTextCursor& cursor)
-{
-    QList<QTextEdit::ExtraSelection> marks;
-    for (auto mark : _editor->extraSelections())
-        if (mark.cursor != cursor)
-            marks << mark;
-    _editor->setExtraSelections(marks);
-}
-
 void TextEditSpellcheck::clearErrorMarks()
 {
     _editor->setExtraSelections(QList<QTextEdit::ExtraSelection>());
@@ -221,8 +355,6 @@ void TextEditSpellcheck::documentChanged(int position, int charsRemoved, int cha
     int stopPos = position + charsAdded;
     if (stopPos > _changesStop) _changesStop = stopPos;
 
-    _isHrefChanged = _isHrefChanged || !_hyperlinkAtCursor.isEmpty();
-
     _timer->start();
 }
 
@@ -230,42 +362,21 @@ void TextEditSpellcheck::spellcheckChanges()
 {
     _timer->stop();
 
-    QTextCursor cursor(_editor->document());
-
-    // We could insert spaces and split a word in two.
-    // Then we have to check not only the current word but also the previous one.
-    // That's the reason for shifting to -1 from _changesStart position.
-    // But if there is/was a hyperlink in place of changes,
-    // it can contain arbitrary number of words, then it better to check all the block.
-    cursor.setPosition(_changesStart > 0 ? _changesStart - 1 : _changesStart);
-    cursor.movePosition(_isHrefChanged ? QTextCursor::StartOfBlock : QTextCursor::StartOfWord, QTextCursor::MoveAnchor);
-    _spellcheckStart = cursor.position();
-
-    cursor.setPosition(_changesStop);
-    cursor.movePosition(_isHrefChanged ? QTextCursor::EndOfBlock : QTextCursor::EndOfWord, QTextCursor::KeepAnchor);
-    _spellcheckStop = cursor.position();
-
-    // Remove marks which are in checking range, they will be recreated on spellcheck
-    QList<QTextEdit::ExtraSelection> errorMarks;
-    for (auto es : _editor->extraSelections())
-        if (es.cursor.position() < _spellcheckStart ||
-            es.cursor.anchor() >= _spellcheckStop)
-            errorMarks << es;
-
-    spellcheck();
-
-    errorMarks.append(_errorMarks);
-    _editor->setExtraSelections(errorMarks);
+    // Changed blocks are checked as a whole, then it doesn't matter
+    // if a word was split in two or if there was a hyperlink in place of changes
+    auto doc = _editor->document();
+    auto first = doc->findBlock(_changesStart);
+    auto last = doc->findBlock(_changesStop);
 
-    _spellcheckStart = -1;
-    _spellcheckStop = -1;
     _changesStart = -1;
     _changesStop = -1;
-}
 
-void TextEditSpellcheck::cursorMoved()
-{
-    _hyperlinkAtCursor = TextEditHelpers::hyperlinkAt(_editor->textCursor());
+    if (!first.isValid())
+        return;
+    if (!last.isValid() || last.blockNumber() < first.blockNumber())
+        last = doc->lastBlock();
+
+    spellcheckBlocks(first, last, PRIORITY_CHANGES);
 }
 
 void TextEditSpellcheck::wordIgnored(const QString& word)
@@ -6,6 +6,9 @@
 #include <QPointer>
 #include <QTextEdit>
 
+#include <atomic>
+#include <memory>
+
 class Spellchecker;
 
 QT_BEGIN_NAMESPACE
@@ -13,6 +16,14 @@ class QAction;
 class QTimer;
 QT_END_NAMESPACE
 
+/**
+    Marks misspelled words in a text editor.
+
+    Text is checked block by block in the spellchecker's thread pool.
+    Texts of blocks are taken from the document in the GUI thread and checked in workers,
+    then found errors are marked for blocks which have not changed since then.
+    Edited blocks are checked first, then blocks visible in the editor, then the rest.
+*/
 class TextEditSpellcheck : public QObject
 {
     Q_OBJECT
@@ -24,27 +35,30 @@ public:
     void spellcheckAll();
 
 private:
+    struct BlockText;
+    struct BlockErrors;
+
     QPointer<QTextEdit> _editor;
     Spellchecker* _spellchecker = nullptr;
     QTimer* _timer = nullptr;
     int _changesStart = -1;
     int _changesStop = -1;
-    bool _isHrefChanged = false;
-    int _spellcheckStart = -1;
-    int _spellcheckStop = -1;
-    QList<QTextEdit::ExtraSelection> _errorMarks;
     bool _changesLocked = false;
-    QString _hyperlinkAtCursor;
+    // Jobs of the previous full check are dropped when a new one starts
+    int _generation = 0;
+    std::shared_ptr<std::atomic<int>> _currentGeneration;
 
-    void spellcheck();
+    static BlockText takeBlockText(const QTextBlock& block);
+    static QList<QPair<int, int>> findErrors(Spellchecker* checker, const BlockText& block);
+    void spellcheckBlocks(const QTextBlock& first, const QTextBlock& last, int priority);
+    void postBlocks(const QList<BlockText>& blocks, int priority);
+    void applyErrors(const QList<BlockErrors>& errors);
     QTextCursor spellingAt(const QPoint& pos) const;
     void contextMenuRequested(const QPoint &pos);
     void addSpellcheckActions(QMenu* menu, QTextCursor &cursor);
-    void removeErrorMark(const QTextCursor& cursor);
     void documentChanged(int position, int charsRemoved, int charsAdded);
     void spellcheckChanges();
     void wordIgnored(const QString& word);
-    void cursorMoved();
 };
 
 #endif // ENABLE_SPELLCHECK
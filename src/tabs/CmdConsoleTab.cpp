@@ -2,9 +2,15 @@
 
 #include "TabHelpers.h"
 #include "core/Enot.h"
+#include "core/MemoBodyCache.h"
+#include "core/MemoStore.h"
+#include "core/SqlHelper.h"
+#include "spellcheck/Spellchecker.h"
 
 #include "helpers/OriLayouts.h"
 
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLabel>
 #include <QLineEdit>
 #include <QSplitter>
@@ -78,6 +84,113 @@ private:
     }
 };
 
+class SqlCacheCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        auto cache = Ori::Sql::StatementCache::instance();
+        int total = cache->hits() + cache->misses();
+        return QString("Prepared statements: %1\nHits: %2\nMisses: %3\nHit rate: %4%")
+            .arg(cache->size())
+            .arg(cache->hits())
+            .arg(cache->misses())
+            .arg(total > 0 ? 100.0 * cache->hits() / total : 0, 0, 'f', 1);
+    }
+};
+
+class SqlStatsCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        return Ori::Sql::QueryStats::instance()->report();
+    }
+};
+
+class SqlStatsJsonCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        return QJsonDocument(Ori::Sql::QueryStats::instance()->toJson()).toJson();
+    }
+};
+
+class SqlStatsResetCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        Ori::Sql::QueryStats::instance()->reset();
+        return "Query statistics cleared";
+    }
+};
+
+class SqlStatsToggleCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        bool on = !Ori::Sql::QueryStats::isEnabled();
+        Ori::Sql::QueryStats::setEnabled(on);
+        return on ? "Query statistics enabled" : "Query statistics disabled";
+    }
+};
+
+class MemoCacheCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        auto cache = MemoBodyCache::instance();
+        return QString("Cached memos: %1\nSize: %2 MB\nBudget: %3 MB\nEvictions: %4")
+            .arg(cache->count())
+            .arg(cache->size() / 1024.0 / 1024.0, 0, 'f', 1)
+            .arg(cache->budget() / 1024.0 / 1024.0, 0, 'f', 1)
+            .arg(cache->evictions());
+    }
+};
+
+#ifdef ENABLE_SPELLCHECK
+class SpellCacheCmd : public Cmd
+{
+public:
+    QString run() override
+    {
+        QStringList lines;
+        for (auto checker : Spellchecker::loaded())
+        {
+            auto stats = checker->cacheStats();
+            qint64 total = stats.hits + stats.misses;
+            lines << QString("%1: %2 of %3 words, hits %4 of %5 (%6%)")
+                .arg(checker->lang())
+                .arg(stats.size)
+                .arg(stats.capacity)
+                .arg(stats.hits)
+                .arg(total)
+                .arg(total > 0 ? stats.hits * 100.0 / total : 0.0, 0, 'f', 1);
+        }
+        return lines.isEmpty() ? QString("No dictionaries loaded") : lines.join('\n');
+    }
+};
+#endif
+
+class SearchReindexCmd : public Cmd
+{
+public:
+    SearchReindexCmd(const CmdConsole* impl): _impl(impl) {}
+    QString run() override
+    {
+        if (!_impl->enot)
+            return "Database is not opened";
+        auto res = _impl->enot->rebuildSearchIndex();
+        return res.isEmpty() ? QString("Search index is being rebuilt") : res;
+    }
+private:
+    const CmdConsole* _impl;
+};
+
 }
 
 using namespace CmdConsoleImpl;
@@ -91,6 +204,16 @@ CmdConsoleTab::CmdConsoleTab(Enot* enot) : QWidget()
     _impl->enot = enot;
     _impl->cmds["help"] = QSharedPointer<HelpCmd>::create(_impl.get());
     _impl->cmds["print_db"] = QSharedPointer<PrintDbCmd>::create(_impl.get());
+    _impl->cmds["sql_cache"] = QSharedPointer<SqlCacheCmd>::create();
+    _impl->cmds["sql_stats"] = QSharedPointer<SqlStatsCmd>::create();
+    _impl->cmds["sql_stats_json"] = QSharedPointer<SqlStatsJsonCmd>::create();
+    _impl->cmds["sql_stats_reset"] = QSharedPointer<SqlStatsResetCmd>::create();
+    _impl->cmds["sql_stats_toggle"] = QSharedPointer<SqlStatsToggleCmd>::create();
+    _impl->cmds["memo_cache"] = QSharedPointer<MemoCacheCmd>::create();
+    _impl->cmds["search_reindex"] = QSharedPointer<SearchReindexCmd>::create(_impl.get());
+#ifdef ENABLE_SPELLCHECK
+    _impl->cmds["spell_cache"] = QSharedPointer<SpellCacheCmd>::create();
+#endif
 
     auto infoLabel = new QLabel;
     infoLabel->setProperty("role", "memo_editor");
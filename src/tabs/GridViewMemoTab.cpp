@@ -1,5 +1,6 @@
 #include "GridViewMemoTab.h"
 
+#include "GridViewModels.h"
 #include "TabHelpers.h"
 #include "core/Enot.h"
 #include "core/MemoStore.h"
@@ -9,7 +10,6 @@
 #include "helpers/OriDialogs.h"
 #include "helpers/OriLayouts.h"
 
-#include <QAbstractTableModel>
 #include <QApplication>
 #include <QCheckBox>
 #include <QComboBox>
@@ -23,7 +23,6 @@
 #include <QTableView>
 #include <QToolBar>
 #include <QToolButton>
-#include <QSortFilterProxyModel>
 #include <QStyledItemDelegate>
 #include <QVBoxLayout>
 #include <QGridLayout>
@@ -33,16 +32,6 @@ using namespace Qt::StringLiterals;
 
 namespace {
 
-enum class ColumnKind { NONE, ID, PROP };
-
-struct ColumnDef
-{
-    ColumnKind kind = ColumnKind::NONE;
-    std::function<QString()> header;
-    std::function<QVariant(Memo*)> value;
-    QHeaderView::ResizeMode resizeMode = QHeaderView::ResizeToContents;
-};
-
 struct PropFormat
 {
     template <typename TValue> struct Format
@@ -65,219 +54,34 @@ struct PropFormat
 
 using PropFormats = QHash<QString, QHash<QString, PropFormat>>;
 
-}
-
-//------------------------------------------------------------------------------
-//                            GridViewTableModel
-//------------------------------------------------------------------------------
-
-class GridViewTableModel : public QAbstractTableModel
+/// Format of a single cell resolved from formats of all props of the row.
+struct CellFormat
 {
-public:
-    GridViewTableModel(Memo *memo, QObject *parent) : QAbstractTableModel(parent)
-    {
-        _self = memo;
-        _folder = memo->parent();
-    }
-
-    int rowCount(const QModelIndex&) const override
-    {
-        return _folder->memos().size();
-    }
-
-    int columnCount(const QModelIndex&) const override
-    {
-        return _columnDefs.size();
-    }
-
-    QVariant headerData(int section, Qt::Orientation orientation, int role) const override
-    {
-        if (role == Qt::DisplayRole)
-        {
-            switch (orientation)
-            {
-            case Qt::Vertical:
-                return section + 1;
-            case Qt::Horizontal:
-                return _columnDefs.at(section).header();
-            }
-        }
-        return QVariant();
-    }
-
-    QVariant data(const QModelIndex &index, int role) const override
-    {
-        if (!index.isValid()) return QVariant();
-
-        const auto& memo = _folder->memos().at(index.row());
-        const auto& column = _columnDefs.at(index.column());
-
-        if (role == Qt::DecorationRole)
-        {
-            if (column.kind == ColumnKind::ID)
-                return memo->type()->icon();
-        }
-        else if (role == Qt::ToolTipRole)
-        {
-            if (column.kind == ColumnKind::ID)
-                return memo->type()->title();
-        }
-        else if (role == Qt::DisplayRole)
-        {
-            return column.value(memo);
-        }
-
-        return QVariant();
-    }
-
-    void itemCreating(Entry* entry, int index)
-    {
-        if (entry->isMemo() && entry->parent() == _folder)
-        {
-            _isRowCountChanging = true;
-            beginInsertRows(QModelIndex(), index, index);
-        }
-    }
-
-    void itemCreated(Entry* entry)
+    std::optional<QColor> backColor;
+    std::optional<QColor> textColor;
+    bool fontB = false;
+    bool fontI = false;
+    bool fontU = false;
+    bool fontS = false;
+
+    void apply(QStyleOptionViewItem *option) const
     {
-        if (_isRowCountChanging)
-        {
-            _isRowCountChanging = false;
-            endInsertRows();
-        }
-    }
-
-    void itemRemoving(Entry* entry)
-    {
-        if (entry->isMemo() && entry->parent() == _folder)
-        {
-            _isRowCountChanging = true;
-            int index = _folder->memos().indexOf(entry);
-            beginRemoveRows(QModelIndex(), index, index);
-        }
-    }
-
-    void itemRemoved(Entry* entry)
-    {
-        if (_isRowCountChanging)
-        {
-            _isRowCountChanging = false;
-            endRemoveRows();
-        }
-    }
-
-    QStringList propColumns() const
-    {
-        QStringList columns;
-        for (const auto& colDef : _columnDefs)
-            if (colDef.kind == ColumnKind::PROP)
-                columns << colDef.header();
-        return columns;
+        if (backColor)
+            option->backgroundBrush = *backColor;
+        if (textColor)
+            option->palette.setBrush(QPalette::Text, *textColor);
+        if (fontB)
+            option->font.setBold(true);
+        if (fontI)
+            option->font.setItalic(true);
+        if (fontU)
+            option->font.setUnderline(true);
+        if (fontS)
+            option->font.setStrikeOut(true);
     }
-
-    void setPropColumns(const QStringList& propNames)
-    {
-        _columnDefs.clear();
-        _columnDefs << ColumnDef {
-            .kind = ColumnKind::ID,
-            .header = []{ return qApp->tr("ID"); },
-            .value = [](Memo* memo){ return memo->id(); },
-        };
-        _columnDefs << ColumnDef {
-            .header = []{ return qApp->tr("Title"); },
-            .value = [](Memo* memo){ return memo->title(); },
-            .resizeMode = QHeaderView::Stretch
-        };
-        for (const auto& propName : propNames)
-        {
-            _columnDefs << ColumnDef {
-                .kind = ColumnKind::PROP,
-                .header = [propName]{ return propName; },
-                .value = [propName](Memo* memo){ return memo->props().value(propName); },
-            };
-        }
-        _columnDefs << ColumnDef {
-            .header = []{ return qApp->tr("Updated"); },
-            .value = [](Memo* memo){ return memo->updated(); },
-        };
-    }
-
-    void reset()
-    {
-        beginResetModel();
-        endResetModel();
-    }
-
-    const QList<ColumnDef>& columnDefs() const { return _columnDefs; }
-
-private:
-    Memo *_self;
-    Folder *_folder;
-    bool _isRowCountChanging = false;
-    QList<ColumnDef> _columnDefs;
 };
 
-//------------------------------------------------------------------------------
-//                            GridViewFilterModel
-//------------------------------------------------------------------------------
-
-class GridViewFilterModel : public QSortFilterProxyModel
-{
-public:
-    GridViewFilterModel(Memo *memo, QObject *parent) : QSortFilterProxyModel(parent)
-    {
-        _folder = memo->parent();
-    }
-
-    bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const override
-    {
-        auto memo = _folder->memos().at(sourceRow);
-
-        if (memo->type() == MemoType::gridView())
-            return false;
-
-        if (!_titleFilter.isEmpty())
-            if (!memo->title().contains(_titleFilter, Qt::CaseInsensitive))
-                return false;
-
-        if (!_propsFilters.isEmpty())
-        {
-            const auto& memoProps = memo->props();
-            for (const auto& filter : std::as_const(_propsFilters))
-            {
-                if (filter.second.isEmpty())
-                    continue;
-                if (!memoProps.contains(filter.first))
-                    return false;
-                if (memoProps.value(filter.first) != filter.second)
-                    return false;
-            }
-        }
-
-        return true;
-    }
-
-    void setFilters(const QString& title, const QList<QPair<QString, QString>>& props)
-    {
-        beginResetModel();
-        _titleFilter = title;
-        _propsFilters = props;
-        endResetModel();
-    }
-
-    void setPropFilters(const QList<QPair<QString, QString>>& props)
-    {
-        beginResetModel();
-        _propsFilters = props;
-        endResetModel();
-    }
-
-private:
-    Folder *_folder;
-    QString _titleFilter;
-    QList<QPair<QString, QString>> _propsFilters;
-};
+}
 
 //------------------------------------------------------------------------------
 //                            GridViewItemDelegate
@@ -302,48 +106,28 @@ public:
     {
         QStyledItemDelegate::initStyleOption(option, index);
 
-        const int curCol = index.column();
-
-        Memo* memo = _gridView->memoAtIndex(index);
-
-        const auto& colDefs = _gridView->_tableModel->columnDefs();
-        const int colCount = colDefs.size();
-        for (int col = 0; col < colCount; col++)
-        {
-            const auto& colDef = colDefs.at(col);
-            if (colDef.kind != ColumnKind::PROP)
-                continue;
-
-            QString propName = colDef.header();
-            if (!_propFormats.contains(propName))
-                continue;
-
-            const auto& propValues = memo->props();
-            if (!propValues.contains(propName))
-                continue;
+        const auto& cells = rowFormat(_gridView->memoAtIndex(index));
+        if (!cells.isEmpty())
+            cells.at(index.column()).apply(option);
+    }
 
-            const auto& propValue = propValues.value(propName);
-            const auto& valueFormats = _propFormats.value(propName);
-            if (!valueFormats.contains(propValue))
-                continue;
+    void setPropFormats(const PropFormats& formats)
+    {
+        _propFormats = formats;
+        _rowFormats.clear();
+    }
 
-            const auto& fmt = valueFormats.value(propValue);
-            if (fmt.backColor && (fmt.backColor->fullRow || col == curCol))
-                option->backgroundBrush = fmt.backColor->value;
-            if (fmt.textColor && (fmt.textColor->fullRow || col == curCol))
-                option->palette.setBrush(QPalette::Text, fmt.textColor->value);
-            if (fmt.fontB && (fmt.fontB->fullRow || col == curCol))
-                option->font.setBold(true);
-            if (fmt.fontI && (fmt.fontI->fullRow || col == curCol))
-                option->font.setItalic(true);
-            if (fmt.fontU && (fmt.fontU->fullRow || col == curCol))
-                option->font.setUnderline(true);
-            if (fmt.fontS && (fmt.fontS->fullRow || col == curCol))
-                option->font.setStrikeOut(true);
-        }
+    /// Should be called when props of the memo change.
+    void forgetRowFormat(Entry* entry)
+    {
+        _rowFormats.remove(entry->id());
     }
 
-    void setPropFormats(const PropFormats& formats) { _propFormats = formats; }
+    /// Should be called when columns change.
+    void forgetRowFormats()
+    {
+        _rowFormats.clear();
+    }
 
     bool configureFormats()
     {
@@ -440,6 +224,63 @@ public:
 private:
     PropFormats _propFormats;
     GridViewMemoTab *_gridView;
+    // Memo id -> formats of the row cells, empty when the row has no formats
+    mutable QHash<int, QList<CellFormat>> _rowFormats;
+
+    const QList<CellFormat>& rowFormat(Memo* memo) const
+    {
+        auto it = _rowFormats.constFind(memo->id());
+        if (it != _rowFormats.cend())
+            return it.value();
+
+        QList<CellFormat> cells;
+
+        const auto& colDefs = _gridView->_tableModel->columnDefs();
+        const int colCount = colDefs.size();
+        const auto& propValues = memo->props();
+        for (int col = 0; col < colCount; col++)
+        {
+            const auto& colDef = colDefs.at(col);
+            if (colDef.kind != ColumnKind::PROP)
+                continue;
+
+            auto formatsIt = _propFormats.constFind(colDef.header());
+            if (formatsIt == _propFormats.cend())
+                continue;
+
+            auto valueIt = propValues.constFind(colDef.header());
+            if (valueIt == propValues.cend())
+                continue;
+
+            auto fmtIt = formatsIt->constFind(valueIt.value());
+            if (fmtIt == formatsIt->cend())
+                continue;
+
+            if (cells.isEmpty())
+                cells.resize(colCount);
+
+            // Later columns override formats of previous ones, as when they were applied cell by cell
+            const auto& fmt = fmtIt.value();
+            for (int c = 0; c < colCount; c++)
+            {
+                auto& cell = cells[c];
+                if (fmt.backColor && (fmt.backColor->fullRow || c == col))
+                    cell.backColor = fmt.backColor->value;
+                if (fmt.textColor && (fmt.textColor->fullRow || c == col))
+                    cell.textColor = fmt.textColor->value;
+                if (fmt.fontB && (fmt.fontB->fullRow || c == col))
+                    cell.fontB = true;
+                if (fmt.fontI && (fmt.fontI->fullRow || c == col))
+                    cell.fontI = true;
+                if (fmt.fontU && (fmt.fontU->fullRow || c == col))
+                    cell.fontU = true;
+                if (fmt.fontS && (fmt.fontS->fullRow || c == col))
+                    cell.fontS = true;
+            }
+        }
+
+        return _rowFormats.insert(memo->id(), cells).value();
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -450,6 +291,9 @@ typedef GridViewMemoTab Self;
 
 GridViewMemoTab::GridViewMemoTab(Enot* enot, Memo* memo) : MemoTab(enot, memo)
 {
+    // Grid shows props of all memos in the folder, get them in one query
+    _enot->preloadProps(memo->parent());
+
     _titleEditor = TabHelpers::makeTitleEditor();
 
     _toolbar = TabHelpers::makeHeaderToolBar();
@@ -485,25 +329,30 @@ GridViewMemoTab::GridViewMemoTab(Enot* enot, Memo* memo) : MemoTab(enot, memo)
 
     _contextMenu = new QMenu;
     auto actionOpen = _contextMenu->addAction(tr("Open"), Qt::Key_Return, this, &Self::openSelectedMemo);
+    _contextMenu->addAction(tr("Set Property..."), this, &Self::setPropForSelected);
 
     auto toolPanel = TabHelpers::makeHeaderPanel({_titleEditor, _toolbar});
 
     _tableModel = new GridViewTableModel(memo, this);
-    connect(_enot, &Enot::entryCreating, _tableModel, &GridViewTableModel::itemCreating);
     connect(_enot, &Enot::entryCreated, _tableModel, &GridViewTableModel::itemCreated);
-    connect(_enot, &Enot::entryDeleted, _tableModel, &GridViewTableModel::itemRemoved);
+    connect(_enot, &Enot::entryUpdated, _tableModel, &GridViewTableModel::itemUpdated);
+    connect(_enot, &Enot::entriesUpdated, _tableModel, &GridViewTableModel::itemsUpdated);
+    connect(_enot, &Enot::memosInserted, _tableModel, &GridViewTableModel::itemsInserted);
     connect(_enot, &Enot::entryDeleting, _tableModel, &GridViewTableModel::itemRemoving);
     connect(_enot, &Enot::entryDeleted, _tableModel, &GridViewTableModel::itemRemoved);
 
-    _filterModel = new GridViewFilterModel(memo, this);
-    _filterModel->setSourceModel(_tableModel);
-
     _itemDelegate = new GridViewItemDelegate(this);
+    connect(_enot, &Enot::entryUpdated, _itemDelegate, &GridViewItemDelegate::forgetRowFormat);
+    connect(_enot, &Enot::entriesUpdated, _itemDelegate, [this](const QList<Entry*>& entries){
+        for (auto entry : entries)
+            _itemDelegate->forgetRowFormat(entry);
+    });
+    connect(_enot, &Enot::entryDeleted, _itemDelegate, &GridViewItemDelegate::forgetRowFormat);
 
     _tableView = new QTableView;
-    _tableView->setModel(_filterModel);
+    _tableView->setModel(_tableModel);
     _tableView->setSelectionBehavior(QAbstractItemView::SelectRows);
-    _tableView->setSelectionMode(QAbstractItemView::SingleSelection);
+    _tableView->setSelectionMode(QAbstractItemView::ExtendedSelection);
     _tableView->verticalHeader()->setVisible(false);
     _tableView->setContextMenuPolicy(Qt::CustomContextMenu);
     _tableView->addAction(actionOpen);
@@ -536,7 +385,7 @@ void GridViewMemoTab::showMemo()
     QString sortOption = config.value(u"sort"_s).toString();
     int sortColumn = qAbs(sortOption.toInt());
     auto sortOrder = sortOption.startsWith('-') ? Qt::DescendingOrder : Qt::AscendingOrder;
-    _filterModel->sort(sortColumn, sortOrder);
+    _tableModel->sort(sortColumn, sortOrder);
 
     QStringList propColumns;
     QString columnOption = config.value(u"columns"_s).toString();
@@ -561,7 +410,7 @@ void GridViewMemoTab::showMemo()
     {
         _filterPanel->setVisible(true);
         _filterPanel->setPropFilters(propFilters);
-        _filterModel->setFilters(titleFilter, propFilters);
+        _tableModel->setFilters(titleFilter, propFilters);
     }
 
     setWindowTitle(_memo->title());
@@ -618,10 +467,18 @@ Memo* GridViewMemoTab::selectedMemo() const
     return memoAtIndex(selection.at(0));
 }
 
+QList<Memo*> GridViewMemoTab::selectedMemos() const
+{
+    QList<Memo*> memos;
+    const auto selection = _tableView->selectionModel()->selectedRows();
+    for (const auto& index : selection)
+        memos << memoAtIndex(index);
+    return memos;
+}
+
 Memo* GridViewMemoTab::memoAtIndex(const QModelIndex& index) const
 {
-    int row = _filterModel->mapToSource(index).row();
-    return _memo->parent()->memos().at(row);
+    return _tableModel->memoAt(index.row());
 }
 
 void GridViewMemoTab::showContextMenu(const QPoint& pos)
@@ -630,6 +487,71 @@ void GridViewMemoTab::showContextMenu(const QPoint& pos)
         _contextMenu->popup(_tableView->mapToGlobal(pos));
 }
 
+void GridViewMemoTab::setPropForSelected()
+{
+    auto memos = selectedMemos();
+    if (memos.isEmpty()) return;
+
+    auto valueEditor = new QComboBox;
+    valueEditor->setEditable(true);
+
+    auto nameEditor = new QComboBox;
+    nameEditor->setEditable(true);
+    for (const auto& propName : _enot->propNames())
+        nameEditor->addItem(propName);
+
+    auto fillPropValues = [this, nameEditor, valueEditor]{
+        auto propName = nameEditor->currentText();
+        valueEditor->clear();
+        for (const auto& propValue : _enot->propValues(propName))
+            valueEditor->addItem(propValue);
+    };
+
+    connect(nameEditor, &QComboBox::currentTextChanged, this, fillPropValues);
+    fillPropValues();
+
+    auto w = Ori::Layouts::LayoutV({
+        tr("Name:"), nameEditor,
+        Ori::Layouts::SpaceV(2),
+        tr("Value:"), valueEditor,
+    }).makeWidgetAuto();
+
+    auto dlg = Ori::Dlg::Dialog(w)
+        .withTitle(tr("Set Property (%1 memos)").arg(memos.size()))
+        .withContentToButtonsSpacingFactor(2)
+        .withVerification([nameEditor]{
+            if (nameEditor->currentText().trimmed().isEmpty())
+                return tr("Property name must not be empty");
+            return QString();
+        });
+    if (!dlg.exec()) return;
+
+    auto name = nameEditor->currentText().trimmed();
+    auto value = valueEditor->currentText().trimmed();
+
+    {
+        // Write all memos in one transaction and repaint the grid once
+        Enot::Batch batch(_enot);
+        for (auto memo : std::as_const(memos))
+        {
+            auto props = memo->props();
+            bool unchanged = value.isEmpty() ? !props.contains(name) : props.value(name) == value;
+            if (unchanged)
+                continue;
+            if (value.isEmpty())
+                props.remove(name);
+            else
+                props[name] = value;
+            MemoUpdateParam update;
+            update.props = props;
+            _enot->updateMemo(memo, update);
+        }
+    }
+
+    if (!value.isEmpty())
+        _enot->addPossiblePropValue(name, value);
+}
+
 void GridViewMemoTab::openSelectedMemo()
 {
     if (!_tableView->hasFocus())
@@ -647,7 +569,7 @@ void GridViewMemoTab::applyFilters()
 {
     auto titleFilter = _filterPanel->titleFilter();
     auto propFilters = _filterPanel->propFilters();
-    _filterModel->setFilters(titleFilter, propFilters);
+    _tableModel->setFilters(titleFilter, propFilters);
 
     QJsonObject filterJson;
     if (!titleFilter.isEmpty())
@@ -667,6 +589,7 @@ void GridViewMemoTab::applyColumns(const QStringList &propNames)
 {
     _tableModel->setPropColumns(propNames);
     _tableModel->reset();
+    _itemDelegate->forgetRowFormats();
 
     auto h = _tableView->horizontalHeader();
     const auto& cols = _tableModel->columnDefs();
@@ -722,8 +645,8 @@ void GridViewMemoTab::chooseColumns()
 
 void GridViewMemoTab::saveSortMode()
 {
-    QString value = QString::number(_filterModel->sortColumn());
-    if (_filterModel->sortOrder() == Qt::DescendingOrder)
+    QString value = QString::number(_tableModel->sortColumn());
+    if (_tableModel->sortOrder() == Qt::DescendingOrder)
         value = '-' + value;
     Store::memos()->updateOption(_memo->id(), "sort", value);
 }
@@ -748,7 +671,7 @@ void GridViewMemoTab::clearFilters()
     if (!_filterPanel->isVisible()) return;
 
     _filterPanel->hide();
-    _filterModel->setFilters({}, {});
+    _tableModel->setFilters({}, {});
     Store::memos()->updateOption(_memo->id(), u"filter"_s, QString());
 }
 
@@ -9,13 +9,11 @@ class QLineEdit;
 class QMenu;
 class QTableView;
 class QToolBar;
-class QSortFilterProxyModel;
 QT_END_NAMESPACE
 
 class Entry;
 class GridFilterPanel;
 class GridViewTableModel;
-class GridViewFilterModel;
 class GridViewItemDelegate;
 
 class GridViewMemoTab : public MemoTab
@@ -36,7 +34,6 @@ private:
     QAction *_actionEdit, *_actionSave, *_actionCancel;
     QTableView *_tableView;
     GridViewTableModel *_tableModel;
-    GridViewFilterModel *_filterModel;
     GridViewItemDelegate *_itemDelegate;
     GridFilterPanel *_filterPanel;
     QMenu *_contextMenu, *_toolMenu;
@@ -47,12 +44,14 @@ private:
     void toggleEditMode(bool on);
     void createMemo();
     void openSelectedMemo();
+    void setPropForSelected();
     void showContextMenu(const QPoint& pos);
     void chooseColumns();
     void showFilterPanel();
     void configurePropFormats();
 
     Memo* selectedMemo() const;
+    QList<Memo*> selectedMemos() const;
     Memo* memoAtIndex(const QModelIndex& index) const;
 
     void clearFilters();
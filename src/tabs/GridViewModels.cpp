@@ -0,0 +1,425 @@
+#include "GridViewModels.h"
+
+#include "core/Enot.h"
+#include "core/MemoType.h"
+
+#include <QApplication>
+
+// How many rows are given to the view at once
+static const int FETCH_BATCH = 1000;
+
+//------------------------------------------------------------------------------
+//                            GridViewTableModel
+//------------------------------------------------------------------------------
+
+GridViewTableModel::GridViewTableModel(Memo *memo, QObject *parent) : QAbstractTableModel(parent)
+{
+    _self = memo;
+    _folder = memo->parent();
+}
+
+int GridViewTableModel::rowCount(const QModelIndex&) const
+{
+    return _fetchedCount;
+}
+
+int GridViewTableModel::columnCount(const QModelIndex&) const
+{
+    return _columnDefs.size();
+}
+
+QVariant GridViewTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role == Qt::DisplayRole)
+    {
+        switch (orientation)
+        {
+        case Qt::Vertical:
+            return section + 1;
+        case Qt::Horizontal:
+            return _columnDefs.at(section).header();
+        }
+    }
+    return QVariant();
+}
+
+QVariant GridViewTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid()) return QVariant();
+
+    int folderRow = _rows.at(index.row());
+    const auto& memo = _folder->memos().at(folderRow);
+    const auto& column = _columnDefs.at(index.column());
+
+    if (role == Qt::DecorationRole)
+    {
+        if (column.kind == ColumnKind::ID)
+            return memo->type()->icon();
+    }
+    else if (role == Qt::ToolTipRole)
+    {
+        if (column.kind == ColumnKind::ID)
+            return memo->type()->title();
+    }
+    else if (role == Qt::DisplayRole)
+    {
+        if (column.value)
+            return column.value(memo);
+        const auto& values = _columns.at(index.column());
+        if (column.number)
+            return values.numbers.at(folderRow);
+        return values.texts.at(folderRow);
+    }
+
+    return QVariant();
+}
+
+bool GridViewTableModel::canFetchMore(const QModelIndex&) const
+{
+    return _fetchedCount < _rows.size();
+}
+
+void GridViewTableModel::fetchMore(const QModelIndex&)
+{
+    int count = qMin(FETCH_BATCH, int(_rows.size()) - _fetchedCount);
+    if (count <= 0) return;
+
+    beginInsertRows(QModelIndex(), _fetchedCount, _fetchedCount + count - 1);
+    _fetchedCount += count;
+    endInsertRows();
+}
+
+void GridViewTableModel::sort(int column, Qt::SortOrder order)
+{
+    _sortColumn = column;
+    _sortOrder = order;
+
+    // Row count doesn't change, so selection can be kept
+    emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+    const auto oldIndexes = persistentIndexList();
+    QList<int> oldRows;
+    oldRows.reserve(oldIndexes.size());
+    for (const auto& idx : oldIndexes)
+        oldRows << _rows.at(idx.row());
+
+    applySort();
+
+    if (!oldIndexes.isEmpty())
+    {
+        QList<int> positions(_folder->memos().size(), -1);
+        for (int i = 0; i < _fetchedCount; i++)
+            positions[_rows.at(i)] = i;
+        QModelIndexList newIndexes;
+        newIndexes.reserve(oldIndexes.size());
+        for (int i = 0; i < oldIndexes.size(); i++)
+        {
+            int row = positions.at(oldRows.at(i));
+            newIndexes << (row < 0 ? QModelIndex() : index(row, oldIndexes.at(i).column()));
+        }
+        changePersistentIndexList(oldIndexes, newIndexes);
+    }
+
+    emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+}
+
+void GridViewTableModel::itemCreated(Entry* entry)
+{
+    if (!entry->isMemo() || entry->parent() != _folder)
+        return;
+
+    // Memos are always added to the end of folder
+    int folderRow = entry->row();
+    for (int c = 0; c < _columnDefs.size(); c++)
+    {
+        const auto& def = _columnDefs.at(c);
+        auto& values = _columns[c];
+        if (def.number)
+            values.numbers.insert(folderRow, def.number(entry->asMemo()));
+        else values.texts.insert(folderRow, def.text(entry->asMemo()));
+    }
+    for (int& row : _rows)
+        if (row >= folderRow)
+            row++;
+
+    if (!isAccepted(folderRow))
+        return;
+
+    // Not fetched rows will be fetched when the view is scrolled to them
+    if (_fetchedCount < _rows.size())
+    {
+        _rows << folderRow;
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), _fetchedCount, _fetchedCount);
+    _rows << folderRow;
+    _fetchedCount++;
+    endInsertRows();
+}
+
+void GridViewTableModel::itemUpdated(Entry* entry)
+{
+    if (entry->isMemo() && entry->parent() == _folder)
+    {
+        int folderRow = entry->row();
+        loadRow(folderRow);
+        int row = _rows.indexOf(folderRow);
+        if (row >= 0 && row < _fetchedCount)
+            emit dataChanged(index(row, 0), index(row, _columnDefs.size()-1));
+    }
+}
+
+void GridViewTableModel::itemsUpdated(const QList<Entry*>& entries)
+{
+    bool changed = false;
+    for (auto entry : entries)
+        if (entry->isMemo() && entry->parent() == _folder)
+        {
+            loadRow(entry->row());
+            changed = true;
+        }
+
+    // Batched changes usually touch many rows of the grid,
+    // it's cheaper to repaint all of them at once than to look up each row
+    if (changed && _fetchedCount > 0)
+        emit dataChanged(index(0, 0), index(_fetchedCount-1, _columnDefs.size()-1));
+}
+
+void GridViewTableModel::itemsInserted(Folder* folder)
+{
+    // Memos are inserted in bulk only while the notebook is being loaded,
+    // no selection to keep yet, so just show everything again
+    if (folder == _folder)
+        reset();
+}
+
+void GridViewTableModel::itemRemoving(Entry* entry)
+{
+    if (!entry->isMemo() || entry->parent() != _folder)
+        return;
+
+    int folderRow = entry->row();
+    int row = _rows.indexOf(folderRow);
+    if (row >= 0 && row < _fetchedCount)
+    {
+        _isRowCountChanging = true;
+        beginRemoveRows(QModelIndex(), row, row);
+        _fetchedCount--;
+    }
+    if (row >= 0)
+        _rows.removeAt(row);
+    for (int& r : _rows)
+        if (r > folderRow)
+            r--;
+    for (int c = 0; c < _columnDefs.size(); c++)
+    {
+        auto& values = _columns[c];
+        if (_columnDefs.at(c).number)
+            values.numbers.removeAt(folderRow);
+        else values.texts.removeAt(folderRow);
+    }
+}
+
+void GridViewTableModel::itemRemoved(Entry* entry)
+{
+    if (_isRowCountChanging)
+    {
+        _isRowCountChanging = false;
+        endRemoveRows();
+    }
+}
+
+Memo* GridViewTableModel::memoAt(int row) const
+{
+    return _folder->memos().at(_rows.at(row));
+}
+
+QStringList GridViewTableModel::propColumns() const
+{
+    QStringList columns;
+    for (const auto& colDef : _columnDefs)
+        if (colDef.kind == ColumnKind::PROP)
+            columns << colDef.header();
+    return columns;
+}
+
+void GridViewTableModel::setPropColumns(const QStringList& propNames)
+{
+    _columnDefs.clear();
+    _columnDefs << ColumnDef {
+        .kind = ColumnKind::ID,
+        .header = []{ return qApp->tr("ID"); },
+        .number = [](Memo* memo){ return qint64(memo->id()); },
+    };
+    _columnDefs << ColumnDef {
+        .header = []{ return qApp->tr("Title"); },
+        .text = [](Memo* memo){ return memo->title(); },
+        .resizeMode = QHeaderView::Stretch
+    };
+    for (const auto& propName : propNames)
+    {
+        _columnDefs << ColumnDef {
+            .kind = ColumnKind::PROP,
+            .header = [propName]{ return propName; },
+            .text = [propName](Memo* memo){ return memo->props().value(propName); },
+        };
+    }
+    _columnDefs << ColumnDef {
+        .header = []{ return qApp->tr("Updated"); },
+        .number = [](Memo* memo){
+            auto updated = memo->updated();
+            return updated.isValid() ? updated.toMSecsSinceEpoch() : 0;
+        },
+        .value = [](Memo* memo){ return memo->updated(); },
+    };
+}
+
+void GridViewTableModel::setFilters(const QString& title, const QList<QPair<QString, QString>>& props)
+{
+    _titleFilter = title;
+    _propsFilters = props;
+    resolveFilters();
+    rebuild();
+}
+
+void GridViewTableModel::reset()
+{
+    loadColumns();
+    resolveFilters();
+    rebuild();
+}
+
+void GridViewTableModel::loadColumns()
+{
+    const auto& memos = _folder->memos();
+    _columns.clear();
+    _columns.resize(_columnDefs.size());
+    for (int c = 0; c < _columnDefs.size(); c++)
+    {
+        const auto& def = _columnDefs.at(c);
+        auto& values = _columns[c];
+        if (def.number)
+        {
+            values.numbers.reserve(memos.size());
+            for (auto memo : memos)
+                values.numbers << def.number(memo);
+        }
+        else
+        {
+            values.texts.reserve(memos.size());
+            for (auto memo : memos)
+                values.texts << def.text(memo);
+        }
+    }
+}
+
+void GridViewTableModel::loadRow(int folderRow)
+{
+    auto memo = _folder->memos().at(folderRow);
+    for (int c = 0; c < _columnDefs.size(); c++)
+    {
+        const auto& def = _columnDefs.at(c);
+        auto& values = _columns[c];
+        if (def.number)
+            values.numbers[folderRow] = def.number(memo);
+        else values.texts[folderRow] = def.text(memo);
+    }
+}
+
+void GridViewTableModel::resolveFilters()
+{
+    _activePropFilters.clear();
+    for (const auto& filter : std::as_const(_propsFilters))
+    {
+        if (filter.second.isEmpty())
+            continue;
+        int column = -1;
+        for (int c = 0; c < _columnDefs.size(); c++)
+        {
+            const auto& def = _columnDefs.at(c);
+            if (def.kind == ColumnKind::PROP && def.header() == filter.first)
+            {
+                column = c;
+                break;
+            }
+        }
+        _activePropFilters << std::make_tuple(column, filter.first, filter.second);
+    }
+}
+
+bool GridViewTableModel::isAccepted(int folderRow) const
+{
+    auto memo = _folder->memos().at(folderRow);
+
+    if (memo->type() == MemoType::gridView())
+        return false;
+
+    if (!_titleFilter.isEmpty())
+        if (!memo->title().contains(_titleFilter, Qt::CaseInsensitive))
+            return false;
+
+    for (const auto& [column, name, value] : _activePropFilters)
+    {
+        if (column >= 0)
+        {
+            if (_columns.at(column).texts.at(folderRow) != value)
+                return false;
+        }
+        else
+        {
+            const auto& memoProps = memo->props();
+            if (!memoProps.contains(name) || memoProps.value(name) != value)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void GridViewTableModel::applyFilters()
+{
+    int count = _folder->memos().size();
+    _rows.clear();
+    _rows.reserve(count);
+    for (int row = 0; row < count; row++)
+        if (isAccepted(row))
+            _rows << row;
+}
+
+void GridViewTableModel::applySort()
+{
+    bool desc = _sortOrder == Qt::DescendingOrder;
+    if (_sortColumn < 0 || _sortColumn >= _columns.size())
+    {
+        std::sort(_rows.begin(), _rows.end());
+        if (desc)
+            std::reverse(_rows.begin(), _rows.end());
+        return;
+    }
+
+    const auto& values = _columns.at(_sortColumn);
+    if (_columnDefs.at(_sortColumn).number)
+    {
+        const auto& numbers = values.numbers;
+        std::stable_sort(_rows.begin(), _rows.end(), [&numbers, desc](int a, int b){
+            return desc ? numbers.at(b) < numbers.at(a) : numbers.at(a) < numbers.at(b);
+        });
+    }
+    else
+    {
+        const auto& texts = values.texts;
+        std::stable_sort(_rows.begin(), _rows.end(), [&texts, desc](int a, int b){
+            return desc ? texts.at(b) < texts.at(a) : texts.at(a) < texts.at(b);
+        });
+    }
+}
+
+void GridViewTableModel::rebuild()
+{
+    beginResetModel();
+    applyFilters();
+    applySort();
+    _fetchedCount = qMin(FETCH_BATCH, int(_rows.size()));
+    endResetModel();
+}
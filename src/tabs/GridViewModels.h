@@ -0,0 +1,107 @@
+#ifndef GRID_VIEW_MODELS_H
+#define GRID_VIEW_MODELS_H
+
+#include <QAbstractTableModel>
+#include <QHeaderView>
+
+class Entry;
+class Folder;
+class Memo;
+
+enum class ColumnKind { NONE, ID, PROP };
+
+struct ColumnDef
+{
+    ColumnKind kind = ColumnKind::NONE;
+    std::function<QString()> header;
+    /// Values of the column are taken from memos once and kept in the model,
+    /// either as numbers or as texts, only one of the getters should be set
+    std::function<qint64(Memo*)> number;
+    std::function<QString(Memo*)> text;
+    /// Optional display value when it differs from the kept one
+    std::function<QVariant(Memo*)> value;
+    QHeaderView::ResizeMode resizeMode = QHeaderView::ResizeToContents;
+};
+
+//------------------------------------------------------------------------------
+//                            GridViewTableModel
+//------------------------------------------------------------------------------
+
+/**
+    Shows memos of a folder, filtered and sorted.
+
+    Values of displayed columns are taken from all memos of the folder once,
+    when columns are set, and kept in plain arrays, one per column.
+    Filtering and sorting run over these arrays, and rows are given
+    to the view by portions as it scrolls (see canFetchMore/fetchMore).
+
+    Changed memos get their values updated but are not moved or hidden
+    until filters or sorting are applied again. New memos are added to the end.
+*/
+class GridViewTableModel : public QAbstractTableModel
+{
+public:
+    GridViewTableModel(Memo *memo, QObject *parent);
+
+    int rowCount(const QModelIndex&) const override;
+    int columnCount(const QModelIndex&) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    bool canFetchMore(const QModelIndex&) const override;
+    void fetchMore(const QModelIndex&) override;
+    void sort(int column, Qt::SortOrder order) override;
+
+    void itemCreated(Entry* entry);
+    void itemUpdated(Entry* entry);
+    void itemsUpdated(const QList<Entry*>& entries);
+    void itemsInserted(Folder* folder);
+    void itemRemoving(Entry* entry);
+    void itemRemoved(Entry* entry);
+
+    QStringList propColumns() const;
+    void setPropColumns(const QStringList& propNames);
+    void setFilters(const QString& title, const QList<QPair<QString, QString>>& props);
+    void reset();
+
+    int sortColumn() const { return _sortColumn; }
+    Qt::SortOrder sortOrder() const { return _sortOrder; }
+
+    Memo* memoAt(int row) const;
+    /// Number of rows passed the filters, including not yet fetched ones.
+    int matchedCount() const { return _rows.size(); }
+
+    const QList<ColumnDef>& columnDefs() const { return _columnDefs; }
+
+private:
+    struct ColumnData
+    {
+        QList<qint64> numbers;
+        QStringList texts;
+    };
+
+    Memo *_self;
+    Folder *_folder;
+    bool _isRowCountChanging = false;
+    QList<ColumnDef> _columnDefs;
+    // Values of all memos of the folder, indexed by memo rows in the folder
+    QList<ColumnData> _columns;
+    // Folder rows of memos passed the filters, in the displayed order
+    QList<int> _rows;
+    int _fetchedCount = 0;
+    int _sortColumn = -1;
+    Qt::SortOrder _sortOrder = Qt::AscendingOrder;
+    QString _titleFilter;
+    QList<QPair<QString, QString>> _propsFilters;
+    // Non-empty prop filters with indices of their columns, -1 if the prop is not shown
+    QList<std::tuple<int, QString, QString>> _activePropFilters;
+
+    void loadColumns();
+    void loadRow(int folderRow);
+    void resolveFilters();
+    bool isAccepted(int folderRow) const;
+    void applyFilters();
+    void applySort();
+    void rebuild();
+};
+
+#endif // GRID_VIEW_MODELS_H
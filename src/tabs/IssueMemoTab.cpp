@@ -6,48 +6,276 @@
 #include "core/MemoStore.h"
 #include "markdown/MarkdownHelper.h"
 #include "widgets/MemoPropsPanel.h"
+#include "widgets/MemoTextBrowser.h"
 
+#include "helpers/OriDialogs.h"
+
+#include <QAbstractListModel>
+#include <QAbstractTextDocumentLayout>
 #include <QAction>
+#include <QCache>
+#include <QDebug>
 #include <QLabel>
 #include <QLineEdit>
-#include <QResizeEvent>
-#include <QScrollArea>
-#include <QTextBrowser>
+#include <QListView>
+#include <QPainter>
+#include <QStyledItemDelegate>
 #include <QTextDocument>
 #include <QToolBar>
-#include <QTimer>
+#include <QtMath>
 
 //------------------------------------------------------------------------------
-//                             IssueMemoTab
+//                             IssueItemsModel
 //------------------------------------------------------------------------------
 
-class IssueMemoView : public QTextBrowser
+struct IssueItem
+{
+    enum Kind { Summary, OlderLink, Comment };
+
+    Kind kind;
+    // Documents and heights of items are cached by keys, it's sheet id for comments
+    int key;
+    int number;
+    // Html text of summary and comments or plain text of the link
+    QString text;
+};
+
+class IssueItemsModel : public QAbstractListModel
 {
 public:
-    explicit IssueMemoView(QWidget *parent = 0) : QTextBrowser()
+    explicit IssueItemsModel(QObject *parent) : QAbstractListModel(parent) {}
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
     {
-        //_label = new QLabel("hello", this);
+        return parent.isValid() ? 0 : _items.size();
     }
 
-protected:
-    void resizeEvent(QResizeEvent *e) override
+    QVariant data(const QModelIndex&, int) const override
     {
-        QTextBrowser::resizeEvent(e);
-        //_label->move(e->size().height() - _label->width(), 0);
+        // Items are painted by the delegate
+        return {};
     }
 
+    Qt::ItemFlags flags(const QModelIndex &index) const override
+    {
+        // Texts are shown in an editor when clicked, so they can be selected and copied
+        if (index.isValid() && _items.at(index.row()).kind != IssueItem::OlderLink)
+            return Qt::ItemIsEnabled | Qt::ItemIsEditable;
+        return Qt::ItemIsEnabled;
+    }
+
+    const IssueItem& itemAt(int row) const { return _items.at(row); }
+
+    bool hasOlderLink() const { return _items.size() > 1 && _items.at(1).kind == IssueItem::OlderLink; }
+
+    void addSummary(const QString& html)
+    {
+        beginInsertRows(QModelIndex(), 0, 0);
+        _items.prepend(IssueItem { .kind = IssueItem::Summary, .key = SUMMARY_KEY, .number = 0, .text = html });
+        endInsertRows();
+    }
+
+    void setOlderLink(const QString& text)
+    {
+        bool has = hasOlderLink();
+        if (text.isEmpty() && has)
+        {
+            beginRemoveRows(QModelIndex(), 1, 1);
+            _items.removeAt(1);
+            endRemoveRows();
+        }
+        else if (!text.isEmpty() && !has)
+        {
+            beginInsertRows(QModelIndex(), 1, 1);
+            _items.insert(1, IssueItem { .kind = IssueItem::OlderLink, .key = OLDER_LINK_KEY, .number = 0, .text = text });
+            endInsertRows();
+        }
+    }
+
+    /// Comments go before already loaded ones, they are older.
+    void prependComments(const QList<IssueItem>& comments)
+    {
+        if (comments.isEmpty())
+            return;
+        int row = hasOlderLink() ? 2 : 1;
+        beginInsertRows(QModelIndex(), row, row + comments.size() - 1);
+        for (int i = 0; i < comments.size(); i++)
+            _items.insert(row + i, comments.at(i));
+        endInsertRows();
+    }
+
+    static constexpr int SUMMARY_KEY = 0;
+    static constexpr int OLDER_LINK_KEY = -1;
+
 private:
-    void linkClicked(const QUrl&)
+    QList<IssueItem> _items;
+};
+
+//------------------------------------------------------------------------------
+//                             IssueItemDelegate
+//------------------------------------------------------------------------------
+
+/**
+    Paints issue summary and comments from their text documents.
+
+    Documents are made only for items being laid out or painted and only some of them are kept,
+    so a long issue takes memory for the visible comments mostly.
+    Heights of items are remembered until the view width changes.
+
+    A clicked item gets a read-only text browser over its document
+    for selecting and copying text, the document is not painted under it.
+*/
+class IssueItemDelegate : public QStyledItemDelegate
+{
+public:
+    IssueItemDelegate(IssueItemsModel *model, QListView *view) : QStyledItemDelegate(view), _model(model), _view(view)
+    {
+        _documents.setMaxCost(MAX_CACHED_DOCUMENTS);
+    }
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override
+    {
+        const auto& item = _model->itemAt(index.row());
+        painter->save();
+        if (item.kind == IssueItem::OlderLink)
+        {
+            painter->setPen(option.palette.color(QPalette::Link));
+            painter->drawText(option.rect, Qt::AlignCenter, item.text);
+        }
+        else if (item.kind == IssueItem::Summary)
+        {
+            if (_editedIndex != index)
+                drawDocument(painter, option, document(item), documentRect(item, option.rect).topLeft());
+        }
+        else
+        {
+            QRect box = option.rect.adjusted(MARGIN, MARGIN, -MARGIN, -MARGIN);
+            QRect header(box.left(), box.top(), box.width(), HEADER_HEIGHT);
+            painter->fillRect(header, option.palette.alternateBase());
+            painter->setPen(option.palette.color(QPalette::Mid));
+            painter->drawRect(box.adjusted(0, 0, -1, -1));
+            painter->drawLine(header.bottomLeft(), header.bottomRight());
+
+            QFont font = option.font;
+            font.setBold(true);
+            font.setPixelSize(15);
+            painter->setFont(font);
+            painter->setPen(option.palette.color(QPalette::PlaceholderText));
+            painter->drawText(header.adjusted(PADDING, 0, 0, 0), Qt::AlignLeft | Qt::AlignVCenter, QString::number(item.number));
+
+            if (_editedIndex != index)
+                drawDocument(painter, option, document(item), documentRect(item, option.rect).topLeft());
+        }
+        painter->restore();
+    }
+
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override
+    {
+        int width = _view->viewport()->width();
+        if (width != _heightsWidth)
+        {
+            _heights.clear();
+            _heightsWidth = width;
+        }
+
+        const auto& item = _model->itemAt(index.row());
+        if (item.kind == IssueItem::OlderLink)
+            return QSize(width, option.fontMetrics.height() + 2*MARGIN);
+
+        auto it = _heights.constFind(item.key);
+        if (it == _heights.constEnd())
+            it = _heights.insert(item.key, qCeil(document(item)->size().height()));
+        int height = it.value() + 2*PADDING;
+        if (item.kind == IssueItem::Comment)
+            height += 2*MARGIN + HEADER_HEIGHT + 1;
+        return QSize(width, height);
+    }
+
+    QWidget* createEditor(QWidget *parent, const QStyleOptionViewItem&, const QModelIndex &index) const override
+    {
+        auto browser = new MemoTextBrowser(parent);
+        // The browser should look the same as the painted document
+        browser->setProperty("role", QVariant());
+        browser->setFrameShape(QFrame::NoFrame);
+        browser->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        browser->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+        browser->setWordWrapMode(QTextOption::WordWrap);
+        browser->viewport()->setAutoFillBackground(false);
+        browser->document()->setDefaultStyleSheet(AppSettings::instance().markdownCss());
+        _editedIndex = index;
+        connect(browser, &QObject::destroyed, this, [this, index]{
+            if (_editedIndex == index)
+                _editedIndex = QPersistentModelIndex();
+            _view->viewport()->update();
+        });
+        return browser;
+    }
+
+    void setEditorData(QWidget *editor, const QModelIndex &index) const override
     {
+        auto browser = qobject_cast<QTextBrowser*>(editor);
+        if (browser && browser->document()->isEmpty())
+            browser->setHtml(_model->itemAt(index.row()).text);
+    }
 
+    void setModelData(QWidget*, QAbstractItemModel*, const QModelIndex&) const override
+    {
+        // Texts are read-only
     }
 
-    void linkHovered(const QUrl&)
+    void updateEditorGeometry(QWidget *editor, const QStyleOptionViewItem &option, const QModelIndex &index) const override
     {
+        editor->setGeometry(documentRect(_model->itemAt(index.row()), option.rect));
+    }
 
+private:
+    static constexpr int MARGIN = 6;
+    static constexpr int PADDING = 6;
+    static constexpr int HEADER_HEIGHT = 30;
+    static constexpr int MAX_CACHED_DOCUMENTS = 100;
+
+    IssueItemsModel *_model;
+    QListView *_view;
+    mutable QCache<int, QTextDocument> _documents;
+    mutable QHash<int, int> _heights;
+    mutable int _heightsWidth = 0;
+    mutable QPersistentModelIndex _editedIndex;
+
+    QTextDocument* document(const IssueItem& item) const
+    {
+        auto doc = _documents.object(item.key);
+        if (!doc)
+        {
+            doc = new QTextDocument;
+            doc->setDefaultStyleSheet(AppSettings::instance().markdownCss());
+            doc->setHtml(item.text);
+            _documents.insert(item.key, doc);
+        }
+        int textWidth = _view->viewport()->width() - 2*PADDING;
+        if (item.kind == IssueItem::Comment)
+            textWidth -= 2*MARGIN;
+        if (doc->textWidth() != textWidth)
+            doc->setTextWidth(textWidth);
+        return doc;
     }
 
-    QLabel *_label;
+    QRect documentRect(const IssueItem& item, const QRect& itemRect) const
+    {
+        QRect rect = itemRect.adjusted(PADDING, PADDING, -PADDING, -PADDING);
+        if (item.kind == IssueItem::Comment)
+            rect.adjust(MARGIN, MARGIN + HEADER_HEIGHT, -MARGIN, -MARGIN);
+        return rect;
+    }
+
+    void drawDocument(QPainter *painter, const QStyleOptionViewItem &option, QTextDocument *doc, const QPoint& pos) const
+    {
+        painter->translate(pos);
+        QAbstractTextDocumentLayout::PaintContext context;
+        context.palette = option.palette;
+        context.clip = QRectF(0, 0, doc->textWidth(), doc->size().height());
+        doc->documentLayout()->draw(painter, context);
+        painter->translate(-pos);
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -79,27 +307,28 @@ IssueMemoTab::IssueMemoTab(Enot* enot, Memo* memo) : MemoTab(enot, memo)
     _propsPanel = new MemoPropsPanel(enot);
     _propsPanel->setVisible(false);
 
-    _summaryView = new IssueMemoView;
-    _summaryView->setObjectName("issue_summary");
-    //_summaryView->setProperty("role", "issue_text");
-    _summaryView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    _summaryView->document()->setDefaultStyleSheet(AppSettings::instance().markdownCss());
-
-    auto contentWidget = new QWidget;
-    contentWidget->setObjectName("issue_content_widget");
-
-    _contentLayout = new QVBoxLayout(contentWidget);
-    _contentLayout->setSpacing(0);
-    _contentLayout->setContentsMargins(0, 0, 0, 0);
-    _contentLayout->addWidget(_summaryView, 0, Qt::AlignTop);
-
-    _contentScroller = new QScrollArea;
-    _contentScroller->setObjectName("issue_content_scroller");
-    _contentScroller->setProperty("role", "memo_editor");
-    _contentScroller->setWidgetResizable(true);
-    _contentScroller->setWidget(contentWidget);
-
-    Ori::Layouts::LayoutV({toolPanel, _propsPanel, _contentScroller}).setMargin(0).setSpacing(0).useFor(this);
+    _itemsModel = new IssueItemsModel(this);
+
+    _itemsView = new QListView;
+    _itemsView->setObjectName("issue_items");
+    _itemsView->setProperty("role", "memo_editor");
+    _itemsView->setSelectionMode(QAbstractItemView::NoSelection);
+    _itemsView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    _itemsView->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    _itemsView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    // Item heights depend on the width, they are recalculated when it changes
+    _itemsView->setResizeMode(QListView::Adjust);
+    _itemsView->setLayoutMode(QListView::Batched);
+    _itemsView->setModel(_itemsModel);
+    _itemsView->setItemDelegate(new IssueItemDelegate(_itemsModel, _itemsView));
+    connect(_itemsView, &QListView::clicked, this, [this](const QModelIndex& index){
+        if (_itemsModel->itemAt(index.row()).kind == IssueItem::OlderLink)
+            loadOlderComments();
+        else
+            _itemsView->edit(index);
+    });
+
+    Ori::Layouts::LayoutV({toolPanel, _propsPanel, _itemsView}).setMargin(0).setSpacing(0).useFor(this);
 
     const auto& props = memo->props();
     for (auto it = props.cbegin(); it != props.cend(); it++)
@@ -112,39 +341,60 @@ IssueMemoTab::IssueMemoTab(Enot* enot, Memo* memo) : MemoTab(enot, memo)
 void IssueMemoTab::showMemo()
 {
     _titleEditor->setText(_memo->title());
-    _summaryView->setHtml(MarkdownHelper::markdownToHtml(_memo->data()));
-    _summaryView->setSizePolicy(QSizePolicy(QSizePolicy::Minimum, QSizePolicy::Fixed));
+    _itemsModel->addSummary(MarkdownHelper::markdownToHtml(_memo->data()));
 
-    int num = 1;
-    auto comments = Store::memos()->loadSheets(_memo->id());
-    for (const auto &comment : std::as_const(comments))
-    {
-        auto label = new QLabel(QString::number(num));
+    auto res = Store::memos()->countSheets(_memo->id(), &_sheetsCount);
+    if (!res.isEmpty())
+        qWarning() << "Unable to count sheets for memo" << _memo->id() << res;
+    loadOlderComments();
 
-        auto header = new QFrame;
-        Ori::Layouts::LayoutH({
-            label,
-            Ori::Layouts::Stretch(),
-        }).setMargin(0).setSpacing(0).useFor(header);
-        header->setProperty("role", "event_header");
-        _contentLayout->addWidget(header, 0, Qt::AlignTop);
+    setWindowTitle(_memo->title());
+}
+
+void IssueMemoTab::loadOlderComments()
+{
+    if (_loadingComments || _loadedSheets >= _sheetsCount)
+        return;
 
-        auto sheetView = new IssueMemoView;
-        sheetView->setProperty("role", "issue_text");
-        sheetView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-        sheetView->document()->setDefaultStyleSheet(AppSettings::instance().markdownCss());
-        sheetView->setHtml(MarkdownHelper::markdownToHtml(comment));
-        _contentLayout->addWidget(sheetView, 0, Qt::AlignTop);
-        _commentViews << sheetView;
+    auto res = Store::memos()->loadSheets(_memo->id(), _loadedSheets, SHEETS_PAGE_SIZE);
+    if (!res.error.isEmpty())
+    {
+        Ori::Dlg::error(res.error);
+        return;
+    }
+    if (res.items.isEmpty())
+    {
+        // Some sheets have been deleted since they were counted
+        _sheetsCount = _loadedSheets;
+        _itemsModel->setOlderLink(QString());
+        return;
+    }
 
-        num++;
+    // Sheets are loaded from the newest one, but shown from the oldest one
+    int pageSize = res.items.size();
+    int firstNumber = _sheetsCount - _loadedSheets - pageSize + 1;
+    _loadedSheets += pageSize;
+    QStringList texts;
+    QList<int> ids;
+    for (auto it = res.items.crbegin(); it != res.items.crend(); it++)
+    {
+        texts << it->data;
+        ids << it->id;
     }
 
-    _contentLayout->addStretch();
+    _loadingComments = true;
 
-    QTimer::singleShot(0, this, &Self::updateViewHeights);
-    
-    setWindowTitle(_memo->title());
+    // Comments are converted in background
+    MarkdownHelper::markdownToHtmlParallel(texts)
+        .then(this, [this, firstNumber, ids](const QStringList& htmls){
+            _loadingComments = false;
+
+            QList<IssueItem> comments;
+            for (int i = 0; i < htmls.size(); i++)
+                comments << IssueItem { .kind = IssueItem::Comment, .key = ids.at(i), .number = firstNumber + i, .text = htmls.at(i) };
+            _itemsModel->prependComments(comments);
+            _itemsModel->setOlderLink(_loadedSheets < _sheetsCount ? tr("Show older comments") : QString());
+        });
 }
 
 void IssueMemoTab::beginEdit()
@@ -190,17 +440,3 @@ void IssueMemoTab::toggleEditMode(bool on)
 
     TabHelpers::setTitleEditorReadOnly(_titleEditor, !on);
 }
-
-void IssueMemoTab::updateViewHeights()
-{
-    const int maxBordersWidth = 40;
-    _summaryView->setFixedHeight(_summaryView->document()->size().height() + maxBordersWidth);
-    for (auto commentView : std::as_const(_commentViews))
-        commentView->setFixedHeight(commentView->document()->size().height() + maxBordersWidth);
-}
-
-void IssueMemoTab::resizeEvent(QResizeEvent *e)
-{
-    MemoTab::resizeEvent(e);
-    updateViewHeights();
-}
\ No newline at end of file
@@ -6,14 +6,18 @@
 QT_BEGIN_NAMESPACE
 class QAction;
 class QLineEdit;
-class QScrollArea;
+class QListView;
 class QToolBar;
-class QVBoxLayout;
 QT_END_NAMESPACE
 
+class IssueItemsModel;
 class MemoPropsPanel;
-class IssueMemoView;
 
+/**
+    Shows issue summary and its comments in a single list view,
+    only visible comments are laid out and painted.
+    The newest comments are loaded first, older ones are loaded on demand.
+*/
 class IssueMemoTab : public MemoTab
 {
 public:
@@ -21,25 +25,24 @@ public:
 
     void beginEdit() override;
 
-protected:
-    void resizeEvent(QResizeEvent *e) override;
-
 private:
     MemoPropsPanel* _propsPanel;
     QLineEdit* _titleEditor;
     QToolBar* _toolbar;
     QAction *_actionEdit, *_actionSave, *_actionCancel;
-    QScrollArea *_contentScroller;
-    QVBoxLayout *_contentLayout;
-    IssueMemoView *_summaryView;
-    QList<IssueMemoView*> _commentViews;
+    QListView *_itemsView;
+    IssueItemsModel *_itemsModel;
+    int _sheetsCount = 0;
+    int _loadedSheets = 0;
+    bool _loadingComments = false;
+
+    static constexpr int SHEETS_PAGE_SIZE = 100;
 
     void showMemo();
+    void loadOlderComments();
     void cancelEdit();
     bool saveEdit();
     void toggleEditMode(bool on);
-
-    void updateViewHeights();
 };
 
 #endif // ISSUE_MEMO_TAB_H
\ No newline at end of file
@@ -3,7 +3,7 @@
 #include "core/Enot.h"
 #include "core/MemoType.h"
 
-MemoTab::MemoTab(Enot *enot, Memo *memo) : QWidget(), _enot(enot), _memo(memo)
+MemoTab::MemoTab(Enot *enot, Memo *memo) : QWidget(), _enot(enot), _memo(memo), _pin(memo)
 {
     setWindowIcon(_memo->type()->icon());
 }
@@ -1,6 +1,8 @@
 #ifndef MEMO_TAB_H
 #define MEMO_TAB_H
 
+#include "core/MemoBodyCache.h"
+
 #include <QWidget>
 
 class Enot;
@@ -30,6 +32,10 @@ protected:
     Memo* _memo;
 
     explicit MemoTab(Enot* enot, Memo* memo);
+
+private:
+    // Text of an opened memo must not be unloaded, it can be edited
+    MemoBodyCache::Pin _pin;
 };
 
 #endif // MEMO_TAB_H
@@ -10,6 +10,9 @@
 
 #include "helpers/OriDialogs.h"
 
+#include <QApplication>
+#include <QEventLoop>
+#include <QFutureWatcher>
 #include <QMessageBox>
 #include <QToolBar>
 #include <QToolButton>
@@ -62,7 +65,7 @@ TextMemoTab::TextMemoTab(Enot* enot, Memo* memo) : MemoTab(enot, memo)
     _toolbar = TabHelpers::makeHeaderToolBar();
 
     _actionEdit = _toolbar->addAction(QIcon(":/toolbar/edit"), tr("Edit"), this, &TextMemoTab::beginEdit);
-    _actionSave = _toolbar->addAction(QIcon(":/toolbar/apply"), tr("Save"), this, &TextMemoTab::saveEdit);
+    _actionSave = _toolbar->addAction(QIcon(":/toolbar/apply"), tr("Save"), this, &TextMemoTab::saveEditAsync);
     _actionCancel = _toolbar->addAction(QIcon(":/toolbar/cancel"), tr("Cancel"), this, &TextMemoTab::cancelEdit);
     _actionEdit->setShortcut(QKeySequence(Qt::Key_Return, Qt::Key_Return));
     _actionSave->setShortcut(QKeySequence::Save);
@@ -175,6 +178,22 @@ void TextMemoTab::loadSettings()
 
 bool TextMemoTab::canClose()
 {
+    if (_isSaving)
+    {
+        // The memo is being written in the storage thread, wait until it's done.
+        // The result is applied in the GUI thread, so events have to be processed meanwhile,
+        // the tab is disabled while saving and can't be changed
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        QFutureWatcher<bool> watcher;
+        QEventLoop loop;
+        connect(&watcher, &QFutureWatcher<bool>::finished, &loop, &QEventLoop::quit);
+        watcher.setFuture(_savingFuture);
+        if (!_savingFuture.isFinished())
+            loop.exec();
+        QApplication::restoreOverrideCursor();
+        // When saving failed, the memo is still modified and the user is asked below
+    }
+
     if (!isModified()) return true;
 
     int res = Ori::Dlg::yesNoCancel(tr("<b>%1</b><br/><br/>"
@@ -225,7 +244,7 @@ void TextMemoTab::cancelEdit()
     emit onReadOnly(true);
 }
 
-bool TextMemoTab::saveEdit()
+MemoUpdateParam TextMemoTab::collectUpdate()
 {
     _propsPanel->apply();
 
@@ -237,16 +256,41 @@ bool TextMemoTab::saveEdit()
         update.data = _memoEditor->data();
     if (_propsPanel->hasValues())
         update.props = _propsPanel->values();
+    return update;
+}
 
-    auto ok = _enot->updateMemo(_memo, update);
+bool TextMemoTab::saveEdit()
+{
+    auto ok = _enot->updateMemo(_memo, collectUpdate());
     if (!ok) return false;
 
+    editSaved();
+    return true;
+}
+
+void TextMemoTab::saveEditAsync()
+{
+    if (_isSaving) return;
+
+    // Don't allow to change the text while it's being written
+    _isSaving = true;
+    setEnabled(false);
+
+    _savingFuture = _enot->updateMemoAsync(_memo, collectUpdate()).then(this, [this](bool ok){
+        _isSaving = false;
+        setEnabled(true);
+        if (ok) editSaved();
+        return ok;
+    });
+}
+
+void TextMemoTab::editSaved()
+{
     _memoEditor->saveEdit();
     _titleEditor->setModified(false);
     setWindowTitle(_memo->title());
     toggleEditMode(false);
     emit onReadOnly(true);
-    return true;
 }
 
 void TextMemoTab::toggleEditMode(bool on)
@@ -3,6 +3,8 @@
 
 #include "MemoTab.h"
 
+#include <QFuture>
+
 QT_BEGIN_NAMESPACE
 class QAction;
 class QLineEdit;
@@ -13,6 +15,7 @@ QT_END_NAMESPACE
 
 class MemoEditor;
 class MemoPropsPanel;
+struct MemoUpdateParam;
 
 class TextMemoTab : public MemoTab
 {
@@ -50,10 +53,15 @@ private:
     QAction *_actionPreview = nullptr, *_actionPreviewButton, *_separatorPreview;
     QToolButton *_previewButton;
     bool _isEditMode = false;
+    bool _isSaving = false;
+    QFuture<bool> _savingFuture;
 
     void showMemo();
     void cancelEdit();
     bool saveEdit();
+    void saveEditAsync();
+    void editSaved();
+    MemoUpdateParam collectUpdate();
 
     void toggleEditMode(bool on);
     void togglePreviewMode();
@@ -0,0 +1,96 @@
+#include "SearchPanel.h"
+
+#include "core/Enot.h"
+#include "core/MemoStore.h"
+#include "core/MemoType.h"
+
+#include "helpers/OriLayouts.h"
+
+#include <QLineEdit>
+#include <QListWidget>
+#include <QTimer>
+
+namespace {
+const int SEARCH_DELAY_MS = 300;
+const int SEARCH_LIMIT = 200;
+}
+
+using Self = SearchPanel;
+
+SearchPanel::SearchPanel() : QFrame()
+{
+    setObjectName("search_panel");
+
+    _searchEdit = new QLineEdit;
+    _searchEdit->setPlaceholderText(tr("Search memos"));
+    _searchEdit->setClearButtonEnabled(true);
+    connect(_searchEdit, &QLineEdit::textChanged, this, [this]{ _searchTimer->start(); });
+    connect(_searchEdit, &QLineEdit::returnPressed, this, [this]{
+        // Open the best match if the search is already done
+        if (!_searchTimer->isActive() && _resultsList->count() > 0)
+            resultActivated(_resultsList->item(0));
+    });
+
+    _searchTimer = new QTimer(this);
+    _searchTimer->setSingleShot(true);
+    _searchTimer->setInterval(SEARCH_DELAY_MS);
+    connect(_searchTimer, &QTimer::timeout, this, &Self::search);
+
+    _resultsList = new QListWidget;
+    _resultsList->setWordWrap(true);
+    connect(_resultsList, &QListWidget::itemActivated, this, &Self::resultActivated);
+
+    Ori::Layouts::LayoutV({_searchEdit, _resultsList}).setMargin(0).setSpacing(3).useFor(this);
+}
+
+void SearchPanel::setEnot(Enot* enot)
+{
+    _enot = enot;
+    _searchTimer->stop();
+    _resultsList->clear();
+    if (_enot && !_searchEdit->text().isEmpty())
+        search();
+}
+
+void SearchPanel::activate()
+{
+    _searchEdit->setFocus();
+    _searchEdit->selectAll();
+}
+
+void SearchPanel::search()
+{
+    _resultsList->clear();
+
+    if (!_enot) return;
+
+    auto res = Store::memos()->search(_searchEdit->text(), SEARCH_LIMIT);
+    if (!res.error.isEmpty())
+    {
+        auto item = new QListWidgetItem(res.error, _resultsList);
+        item->setFlags(Qt::NoItemFlags);
+        return;
+    }
+
+    for (const auto& it : std::as_const(res.items))
+    {
+        // Memos can still be loading when the notebook is opened progressively
+        auto memo = _enot->findMemoById(it.memoId);
+        if (!memo) continue;
+
+        auto item = new QListWidgetItem(memo->type()->icon(), memo->title(), _resultsList);
+        item->setData(Qt::UserRole, it.memoId);
+        item->setToolTip(it.snippet);
+        if (!it.snippet.isEmpty())
+            item->setText(memo->title() + '\n' + it.snippet.simplified());
+    }
+}
+
+void SearchPanel::resultActivated(QListWidgetItem* item)
+{
+    if (!_enot || !item) return;
+
+    auto memo = _enot->findMemoById(item->data(Qt::UserRole).toInt());
+    if (memo)
+        emit memoOpenRequested(memo);
+}
@@ -0,0 +1,39 @@
+#ifndef SEARCH_PANEL_H
+#define SEARCH_PANEL_H
+
+#include <QFrame>
+
+QT_BEGIN_NAMESPACE
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+class QTimer;
+QT_END_NAMESPACE
+
+class Enot;
+class Memo;
+
+class SearchPanel : public QFrame
+{
+    Q_OBJECT
+
+public:
+    SearchPanel();
+
+    void setEnot(Enot* enot);
+    void activate();
+
+signals:
+    void memoOpenRequested(Memo* memo);
+
+private:
+    Enot* _enot = nullptr;
+    QLineEdit* _searchEdit;
+    QListWidget* _resultsList;
+    QTimer* _searchTimer;
+
+    void search();
+    void resultActivated(QListWidgetItem* item);
+};
+
+#endif // SEARCH_PANEL_H
@@ -103,21 +103,29 @@ public:
             return QModelIndex();
         }
 
-        // Row index of the parent folder inside its own parent
+        return entryIndex(parentFolder);
+    }
+
+    QModelIndex entryIndex(Entry* entry) const
+    {
+        // Row index of the entry inside its own parent
         int row;
 
-        auto superParentFolder = parentFolder->parent();
-        if (!superParentFolder)
+        auto parentFolder = entry->parent();
+        if (!parentFolder)
         {
-            // The parent of parent is the root
-            // This should not be the case because the root tree-item has no children
+            // The entry is the root
             row = 0;
         }
         else
         {
-            row = superParentFolder->folders().indexOf(parentFolder);
+            row = entry->row();
 
-            if (superParentFolder->isRoot())
+            // Memos go before subfolders
+            if (entry->isFolder())
+                row += parentFolder->memos().size();
+
+            if (parentFolder->isRoot())
             {
                 // Increase for the root item
                 // which is in the tree at the top level alongside with its own children
@@ -125,7 +133,7 @@ public:
             }
         }
 
-        return createIndex(row, 0, parentFolder);
+        return createIndex(row, 0, entry);
     }
     
     QVariant data(const QModelIndex &index, int role) const override
@@ -160,19 +168,10 @@ public:
         return QVariant();
     }
 
-    QModelIndex findIndex(Entry* entry, const QModelIndex &parent = QModelIndex())
+    QModelIndex findIndex(Entry* entry)
     {
-        int rows = rowCount(parent);
-        for (int row = 0; row < rows; row++)
-        {
-            auto currentIndex = index(row, 0, parent);
-            auto currentEntry = asEntry(currentIndex);
-            if (currentEntry == entry) return currentIndex;
-
-            auto targetIndex = findIndex(entry, currentIndex);
-            if (targetIndex.isValid()) return targetIndex;
-        }
-        return QModelIndex();
+        if (!entry) return QModelIndex();
+        return entryIndex(entry);
     }
 
     void itemRenamed(Entry* item)
@@ -186,6 +185,20 @@ public:
         emit dataChanged(index, index);
     }
 
+    void memosInserting(Folder* folder, int first, int count)
+    {
+        // Children of the root are shown at the top level after the root item itself
+        if (folder->isRoot())
+            beginInsertRows(QModelIndex(), first + 1, first + count);
+        else
+            beginInsertRows(entryIndex(folder), first, first + count - 1);
+    }
+
+    void memosInserted(Folder*)
+    {
+        endInsertRows();
+    }
+
     void reset()
     {
         beginResetModel();
@@ -244,10 +257,15 @@ void TreeWidget::setEnot(Enot* enot)
         connect(_enot, &Enot::entryCreating, this, &Self::entryCreating);
         connect(_enot, &Enot::entryCreated, this, &Self::entryCreated);
         connect(_enot, &Enot::entryUpdated, this, &Self::entryUpdated);
+        connect(_enot, &Enot::entriesUpdated, this, &Self::entriesUpdated);
         connect(_enot, &Enot::entryDeleting, this, &Self::entryDeleting);
         connect(_enot, &Enot::entryDeleted, this, &Self::entryDeleted);
+        connect(_enot, &Enot::memosInserting, _model, &TreeModel::memosInserting);
+        connect(_enot, &Enot::memosInserted, _model, &TreeModel::memosInserted);
     }
     _treeView->setModel(_model);
+    if (_model)
+        connect(_treeView->selectionModel(), &QItemSelectionModel::currentChanged, this, &Self::prefetchNeighbours);
 }
 
 Entry* TreeWidget::selectedEntry() const
@@ -287,6 +305,23 @@ void TreeWidget::selectEntry(Entry* entry)
     });
 }
 
+void TreeWidget::prefetchNeighbours(const QModelIndex& index)
+{
+    // How many memos above and below the selected one to load in advance
+    const int K = 5;
+
+    if (!_enot) return;
+
+    auto entry = TreeModel::asEntry(index);
+    if (!entry || !entry->isMemo() || !entry->parent()) return;
+
+    const auto& memos = entry->parent()->memos();
+    int row = entry->row();
+    int first = qMax(0, row - K);
+    int last = qMin(int(memos.size()) - 1, row + K);
+    _enot->prefetchMemos(memos.mid(first, last - first + 1));
+}
+
 void TreeWidget::openMemo()
 {
     if (!_model) return;
@@ -330,13 +365,16 @@ void TreeWidget::deleteFolder()
     auto confirm = tr("Are you sure to delete folder '%1' and all its content?").arg(entry->title());
     if (!Ori::Dlg::yes(confirm)) return;
 
-    auto parentFolder = entry->parent();
-
-    bool ok = _enot->deleteFolder(entry->asFolder());
-    if (!ok) return;
+    auto parentId = entry->parent()->id();
 
-    QTimer::singleShot(0, this, [this, parentFolder]{
-        _treeView->setCurrentIndex(_model->findIndex(parentFolder));
+    // A large folder can take a while to delete, it's done in the storage thread
+    _enot->deleteFolderAsync(entry->asFolder()).then(this, [this, parentId](bool ok){
+        if (!ok || !_model) return;
+        auto parentFolder = parentId == _enot->root()->id() ? _enot->root() : _enot->findFolderById(parentId);
+        if (!parentFolder) return;
+        QTimer::singleShot(0, this, [this, parentFolder]{
+            _treeView->setCurrentIndex(_model->findIndex(parentFolder));
+        });
     });
 }
 
@@ -388,6 +426,12 @@ void TreeWidget::entryUpdated(Entry* entry)
     _model->itemRenamed(entry);
 }
 
+void TreeWidget::entriesUpdated(const QList<Entry*>& entries)
+{
+    for (auto entry : entries)
+        _model->itemRenamed(entry);
+}
+
 void TreeWidget::entryDeleting(Entry* entry)
 {
     if (entry->isMemo() && _isFolderDeleting)
@@ -5,6 +5,7 @@
 
 QT_BEGIN_NAMESPACE
 class QMenu;
+class QModelIndex;
 class QTreeView;
 QT_END_NAMESPACE
 
@@ -46,11 +47,13 @@ private:
     void createMemo();
     void deleteMemo();
     void openMemo();
+    void prefetchNeighbours(const QModelIndex& index);
 
     void contextMenuRequested(const QPoint &pos);
     void entryCreating(Entry*, int);
     void entryCreated(Entry*);
     void entryUpdated(Entry*);
+    void entriesUpdated(const QList<Entry*>&);
     void entryDeleting(Entry*);
     void entryDeleted(Entry*);
 